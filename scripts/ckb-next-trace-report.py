@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+# Turns a capture from ckb-next-trace.bt into per-stage latencies.
+# Usage: scripts/ckb-next-trace-report.py trace.txt
+import sys
+from collections import defaultdict
+
+MACRO_OPS = ["key", "scroll", "move", "sync", "sleep"]
+
+# Stage name -> list of durations in ns
+stages = defaultdict(list)
+macro_actions = defaultdict(int)
+
+# First input URB per device that hasn't reached uinput yet
+pending_urb = {}
+# Open spans per thread
+input_urb = {}
+input_update = {}
+readcmd = {}
+readcmd_last_send = {}
+usb_send = {}
+usb_recv = {}
+mutex_wait = {}
+
+f = open(sys.argv[1], "r") if len(sys.argv) > 1 else sys.stdin
+for line in f:
+    fields = line.split()
+    if len(fields) < 3 or not fields[0].isdigit():
+        # bpftrace's "Attaching N probes..." and similar
+        continue
+    ts, tid, name, args = int(fields[0]), int(fields[1]), fields[2], [int(a) for a in fields[3:]]
+
+    if name == "input_urb":
+        pending_urb.setdefault(args[0], ts)
+        input_urb[tid] = ts
+    elif name == "input_urb_done":
+        if tid in input_urb:
+            stages["input URB"].append(ts - input_urb.pop(tid))
+    elif name == "input_update":
+        input_update[tid] = ts
+    elif name == "input_sync":
+        if tid in input_update:
+            stages["inputupdate"].append(ts - input_update.pop(tid))
+        if args[0] in pending_urb:
+            stages["USB -> uinput"].append(ts - pending_urb.pop(args[0]))
+    elif name == "readcmd_start":
+        readcmd[tid] = ts
+        readcmd_last_send.pop(tid, None)
+    elif name == "readcmd_end":
+        if tid in readcmd:
+            start = readcmd.pop(tid)
+            stages["readcmd"].append(ts - start)
+            if tid in readcmd_last_send:
+                stages["FIFO -> USB"].append(readcmd_last_send.pop(tid) - start)
+    elif name == "usb_send":
+        usb_send[tid] = ts
+    elif name == "usb_send_done":
+        if tid in usb_send:
+            stages["usbsend"].append(ts - usb_send.pop(tid))
+        if tid in readcmd and args[1] > 0:
+            readcmd_last_send[tid] = ts
+    elif name == "usb_recv":
+        usb_recv[tid] = ts
+    elif name == "usb_recv_done":
+        if tid in usb_recv:
+            stages["usbrecv"].append(ts - usb_recv.pop(tid))
+    elif name == "mutex_wait":
+        mutex_wait[tid] = ts
+    elif name == "mutex_acquired":
+        if tid in mutex_wait:
+            stages["mutex wait"].append(ts - mutex_wait.pop(tid))
+    elif name == "macro_action":
+        op = args[1]
+        macro_actions[MACRO_OPS[op] if op < len(MACRO_OPS) else str(op)] += 1
+
+if f is not sys.stdin:
+    f.close()
+
+def percentile(values, p):
+    return values[min(len(values) - 1, len(values) * p // 100)]
+
+print("%-16s %10s %10s %10s %10s %10s" % ("stage (us)", "count", "p50", "p90", "p99", "max"))
+for name in ["USB -> uinput", "input URB", "inputupdate", "FIFO -> USB", "readcmd", "usbsend", "usbrecv", "mutex wait"]:
+    values = sorted(stages[name])
+    if not values:
+        continue
+    print("%-16s %10d %10.1f %10.1f %10.1f %10.1f" % (name, len(values),
+        percentile(values, 50) / 1000, percentile(values, 90) / 1000,
+        percentile(values, 99) / 1000, values[-1] / 1000))
+
+if macro_actions:
+    print()
+    print("macro actions: " + ", ".join("%s %d" % (op, count) for op, count in sorted(macro_actions.items())))
@@ -0,0 +1,164 @@
+// Times readcmd() on a full-board rgb line, the command the GUI sends for every frame on devices without the frame node.
+// The key name lookup is also timed on its own, against the linear keymap scan it replaced.
+//
+// Usage: ckb-next-cmdbench [-n <rounds>] [<vid>:<pid> ...]
+// Without devices, a K95 RGB Platinum (1b1c:1b2d) is used. cmd_rgb() is the daemon's own, updatergb only counts calls.
+
+#include "command.h"
+#include "device.h"
+#include "keymap.h"
+#include "keymap_patch.h"
+#include "led.h"
+#include "stubs.h"
+
+static uint64_t updates;
+
+static int updatergb(usbdevice* kb, int force){
+    (void)kb;
+    (void)force;
+    updates++;
+    return 0;
+}
+
+static int updatedpi(usbdevice* kb, int force){
+    (void)kb;
+    (void)force;
+    return 0;
+}
+
+// Sets up a device in software mode with just enough of a vtable for rgb commands
+static void setupdevice(usbdevice* kb, ushort vendor, ushort product){
+    memset(kb, 0, sizeof(*kb));
+    kb->vendor = vendor;
+    kb->product = product;
+    kb->status = DEV_STATUS_CONNECTED;
+    patchkeys(kb);
+    kb->profile = calloc(1, sizeof(usbprofile));
+    kb->profile->currentmode = kb->profile->mode;
+    kb->vtable.rgb = cmd_rgb;
+    kb->vtable.updatergb = updatergb;
+    kb->vtable.updatedpi = updatedpi;
+}
+
+// "rgb <key>:<color> ..." for every key with an LED. Returns the number of keys
+static int rgbline(const usbdevice* kb, char* line, size_t size){
+    int keys = 0;
+    size_t len = snprintf(line, size, "rgb");
+    for(int i = 0; i < N_KEYS_EXTENDED && len < size; i++){
+        const key* k = kb->keymap + i;
+        if(!k->name || k->led < 0)
+            continue;
+        len += snprintf(line + len, size - len, " %s:%02x%02x%02x", k->name, i & 0xff, (i * 7) & 0xff, (i * 13) & 0xff);
+        keys++;
+    }
+    if(len + 2 >= size)
+        return -1;
+    strcpy(line + len, "\n");
+    return keys;
+}
+
+static int linearkey(const usbdevice* kb, const char* name){
+    for(int i = 0; i < N_KEYS_EXTENDED; i++){
+        if(kb->keymap[i].name && !strcmp(name, kb->keymap[i].name))
+            return i;
+    }
+    return -1;
+}
+
+static uint64_t nsecs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench(const char* spec, int rounds){
+    ushort vendor, product;
+    if(sscanf(spec, "%hx:%hx", &vendor, &product) != 2){
+        ckb_err_nofile("Invalid argument %s. Expected <vid>:<pid>", spec);
+        return -1;
+    }
+    usbdevice* kb = keyboard + 1;
+    setupdevice(kb, vendor, product);
+
+    static char line[16384], work[16384];
+    int keys = rgbline(kb, line, sizeof(line));
+    if(keys <= 0){
+        ckb_err_nofile("%s: No keys with LEDs", spec);
+        free(kb->profile);
+        return -1;
+    }
+    size_t len = strlen(line) + 1;
+    const char* names[N_KEYS_EXTENDED];
+    int count = 0;
+    for(int i = 0; i < N_KEYS_EXTENDED; i++){
+        if(kb->keymap[i].name && kb->keymap[i].led >= 0)
+            names[count++] = kb->keymap[i].name;
+    }
+
+    // readcmd() tokenizes the line in place, so it works on a fresh copy each round. The copy is timed separately
+    updates = 0;
+    uint64_t start = nsecs();
+    for(int round = 0; round < rounds; round++)
+        memcpy(work, line, len);
+    uint64_t copy = nsecs() - start;
+    start = nsecs();
+    for(int round = 0; round < rounds; round++){
+        memcpy(work, line, len);
+        readcmd(kb, work);
+    }
+    uint64_t parse = nsecs() - start;
+    parse = parse > copy ? parse - copy : 0;
+
+    // Key name lookups alone
+    volatile int sink = 0;
+    start = nsecs();
+    for(int round = 0; round < rounds; round++){
+        for(int i = 0; i < count; i++)
+            sink += findkey(kb, names[i]);
+    }
+    uint64_t hashed = nsecs() - start;
+    start = nsecs();
+    for(int round = 0; round < rounds; round++){
+        for(int i = 0; i < count; i++)
+            sink += linearkey(kb, names[i]);
+    }
+    uint64_t linear = nsecs() - start;
+    (void)sink;
+
+    printf("%04x:%04x %3d keys x %d: %8.1f ns/line (%.1f ns/key), key lookup %.1f ns hashed vs %.1f ns linear\n",
+           vendor, product, keys, rounds, (double)parse / rounds, (double)parse / rounds / keys,
+           (double)hashed / rounds / count, (double)linear / rounds / count);
+
+    // Every key has to resolve to itself, and every line has to reach updatergb
+    int res = (updates == (uint64_t)rounds) ? 0 : -1;
+    for(int i = 0; i < count; i++){
+        if(findkey(kb, names[i]) != linearkey(kb, names[i])){
+            ckb_err_nofile("%s: Key %s resolves to %d instead of %d", spec, names[i], findkey(kb, names[i]), linearkey(kb, names[i]));
+            res = -1;
+        }
+    }
+    free(kb->profile);
+    kb->profile = NULL;
+    return res;
+}
+
+int main(int argc, char** argv){
+    int rounds = 10000;
+    int arg = 1;
+    if(arg + 1 < argc && !strcmp(argv[arg], "-n")){
+        rounds = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if(rounds < 1){
+        printf("Usage: %s [-n <rounds>] [<vid>:<pid> ...]\n", argv[0]);
+        return 1;
+    }
+    if(arg == argc)
+        return bench("1b1c:1b2d", rounds) ? 1 : 0;
+    int res = 0;
+    for(; arg < argc; arg++){
+        if(bench(argv[arg], rounds))
+            res = 1;
+    }
+    return res;
+}
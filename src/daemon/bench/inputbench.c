@@ -0,0 +1,241 @@
+// Replays recorded input reports through process_input_urb() and inputupdate() without hardware or uinput,
+// and reports the time and the number of allocations it takes per report.
+//
+// Usage: ckb-next-inputbench [-n <rounds>] <vid>:<pid>:<reports> ...
+// The report files use the same "<delay ms> <endpoint> <bytes...>" lines as --simulate. The delays are ignored.
+// Everything from the URB up to the os_* calls is the daemon's own code. The os_* functions in stubs.c only count events.
+// Each file is replayed twice, the second time with the macros below bound, and the two runs are reported separately.
+
+#include "device.h"
+#include "input.h"
+#include "keymap.h"
+#include "keymap_patch.h"
+#include "usb.h"
+#include "stubs.h"
+
+#define REPORT_MAX 64
+
+typedef struct {
+    ushort ep;
+    int len;
+    uchar data[REPORT_MAX];
+} benchreport;
+
+// Allocations made by the daemon code, counted with ld --wrap
+static uint64_t allocations;
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size){
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size){
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size){
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+// "e" is pressed in every typing report, the others never match and are only checked on each key change.
+// The macro key presses come from the device's macro thread and are counted separately from the replayed ones.
+static const char* const benchmacros[][2] = {
+    { "e",                  "+f13,-f13" },
+    { "lctrl+lalt+del",     "+f14,-f14" },
+    { "lctrl+lshift+esc",   "+f15,-f15" },
+    { "rwin+f12",           "+f16,-f16" },
+};
+
+static int loadreports(const char* path, benchreport** reports){
+    FILE* file = fopen(path, "r");
+    if(!file){
+        ckb_err_nofile("Unable to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    char line[1024];
+    int lineno = 0, count = 0;
+    *reports = NULL;
+    while(fgets(line, sizeof(line), file)){
+        lineno++;
+        char* pos = line;
+        while(isspace(*pos))
+            pos++;
+        if(!*pos || *pos == '#')
+            continue;
+        benchreport report = { 0 };
+        uint32_t delay;
+        int len = 0;
+        if(sscanf(pos, "%"SCNu32" %hx%n", &delay, &report.ep, &len) != 2){
+            ckb_err_nofile("%s:%d: Expected \"<delay> <endpoint> <bytes...>\"", path, lineno);
+            break;
+        }
+        pos += len;
+        while(report.len < REPORT_MAX && sscanf(pos, " %hhx%n", report.data + report.len, &len) == 1){
+            report.len++;
+            pos += len;
+        }
+        if(!report.len)
+            continue;
+        benchreport* grown = realloc(*reports, (count + 1) * sizeof(benchreport));
+        if(!grown)
+            break;
+        *reports = grown;
+        (*reports)[count++] = report;
+    }
+    fclose(file);
+    if(!count)
+        ckb_err_nofile("%s: No reports", path);
+    return count ? count : -1;
+}
+
+// Sets up a device in software mode the way _setupusb() would, without talking to it
+static void setupdevice(usbdevice* kb, ushort vendor, ushort product, int macros){
+    memset(kb, 0, sizeof(*kb));
+    kb->vendor = vendor;
+    kb->product = product;
+    kb->status = DEV_STATUS_CONNECTED;
+    if(USES_BRAGI(vendor, product)){
+        kb->protocol = PROTO_BRAGI;
+        kb->bragi_in_ep = 0x84;
+    }
+    kb->out_ep_packet_size = MSG_SIZE;
+    kb->fwversion = (kb->protocol == PROTO_BRAGI ? 0 : 0x300);
+    patchkeys(kb);
+    kb->profile = calloc(1, sizeof(usbprofile));
+    kb->profile->currentmode = kb->profile->mode;
+    initbind(&kb->profile->currentmode->bind, kb);
+    if(macros){
+        for(size_t i = 0; i < sizeof(benchmacros) / sizeof(benchmacros[0]); i++)
+            cmd_macro(kb, kb->profile->currentmode, 0, benchmacros[i][0], benchmacros[i][1]);
+    }
+    // Any non-zero handle, the stubs never use them
+    kb->uinput_kb = kb->uinput_mouse = 1;
+    kb->active = 1;
+}
+
+static void freedevice(usbdevice* kb){
+    // Let the macros triggered at the end of the replay finish, then stop the macro thread like closeusb() does
+    const binding* bind = &kb->profile->currentmode->bind;
+    for(int tries = 0; tries < 5000; tries++){
+        int playing = 0;
+        queued_mutex_lock(imutex(kb));
+        for(int i = 0; i < bind->macrocount; i++)
+            playing |= bind->macros[i].param != NULL;
+        queued_mutex_unlock(imutex(kb));
+        if(!playing)
+            break;
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+    queued_mutex_lock(dmutex(kb));
+    queued_mutex_lock(imutex(kb));
+    macro_stopthread(kb);
+    queued_mutex_unlock(imutex(kb));
+    queued_mutex_unlock(dmutex(kb));
+    freebind(&kb->profile->currentmode->bind);
+    free(kb->profile);
+    kb->profile = NULL;
+}
+
+static void nullhandler(int s){
+    (void)s;
+}
+
+static uint64_t nsecs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int replay(ushort vendor, ushort product, const char* name, benchreport* reports, int count, int rounds,
+                  int macros){
+    usbdevice* kb = keyboard + 1;
+    setupdevice(kb, vendor, product, macros);
+    keypresses = syncs = mousemoves = mousescrolls = macrokeypresses = 0;
+    allocations = 0;
+
+    uint64_t best = UINT64_MAX, total = 0;
+    for(int round = 0; round < rounds; round++){
+        uint64_t start = nsecs();
+        for(int i = 0; i < count; i++)
+            process_input_urb(kb, reports[i].data, reports[i].len, reports[i].ep);
+        uint64_t time = nsecs() - start;
+        total += time;
+        if(time < best)
+            best = time;
+    }
+    uint64_t processed = (uint64_t)count * rounds;
+    // Allocations made while the last macros finish aren't part of the replay
+    uint64_t replayallocations = allocations;
+    freedevice(kb);
+    printf("%-28s %-8s %5d reports x %d: %8.1f ns/report (best round %.1f), %.3f allocations/report, "
+           "%"PRIu64" keypresses, %"PRIu64" moves, %"PRIu64" scrolls, %"PRIu64" syncs",
+           name, macros ? "(macros)" : "", count, rounds, (double)total / processed, (double)best / count,
+           (double)replayallocations / processed, keypresses, mousemoves, mousescrolls, syncs);
+    if(macros)
+        printf(", %"PRIu64" macro keypresses", macrokeypresses);
+    printf("\n");
+
+    // Every replay has to reach the OS, otherwise the reports weren't understood.
+    // On keyboards, the typing also has to trigger the macro on "e".
+    if(!keypresses && !mousemoves)
+        return -1;
+    if(macros && !IS_MOUSE(vendor, product) && !macrokeypresses)
+        return -1;
+    return 0;
+}
+
+static int bench(const char* spec, int rounds){
+    ushort vendor, product;
+    int len = 0;
+    if(sscanf(spec, "%hx:%hx:%n", &vendor, &product, &len) != 2 || !len){
+        ckb_err_nofile("Invalid argument %s. Expected <vid>:<pid>:<reports>", spec);
+        return -1;
+    }
+    const char* path = spec + len;
+    benchreport* reports;
+    int count = loadreports(path, &reports);
+    if(count < 0)
+        return -1;
+
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    int res = replay(vendor, product, name, reports, count, rounds, 0);
+    res |= replay(vendor, product, name, reports, count, rounds, 1);
+    free(reports);
+    return res;
+}
+
+int main(int argc, char** argv){
+    int rounds = 10000;
+    int arg = 1;
+    if(arg + 1 < argc && !strcmp(argv[arg], "-n")){
+        rounds = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if(arg == argc || rounds < 1){
+        printf("Usage: %s [-n <rounds>] <vid>:<pid>:<reports> ...\n", argv[0]);
+        return 1;
+    }
+    // Same setup as main.c: the macro thread is stopped with SIGUSR2, and sleeps on monotonic condition variables
+    struct sigaction action = {
+        .sa_handler = nullhandler,
+        .sa_flags = 0,
+    };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, NULL);
+    if(init_cond_monotonic()){
+        ckb_err_nofile("Failed to initialize monotonic clock");
+        return 1;
+    }
+    int res = 0;
+    for(; arg < argc; arg++){
+        if(bench(argv[arg], rounds))
+            res = 1;
+    }
+    return res;
+}
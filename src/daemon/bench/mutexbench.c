@@ -0,0 +1,94 @@
+// Measures queued_mutex_t under contention. It is built once per implementation (ckb-next-mutexbench-condvar, -futex
+// and -pthread for NO_FAIR_MUTEX_QUEUEING), so the same run can be compared across them.
+//
+// Usage: ckb-next-mutexbench-<variant> [-n <locks per thread>] [<threads> ...]
+// Each thread takes the mutex, does a short piece of work inside, and a longer one outside, like the device threads do
+// around a USB transfer. The first thread also waits in queued_cond_nanosleep() every 1000 locks.
+
+#include "device.h"
+#include <sys/resource.h>
+
+#if defined(NO_FAIR_MUTEX_QUEUEING)
+#define MUTEX_VARIANT "pthread"
+#elif defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+#define MUTEX_VARIANT "futex"
+#else
+#define MUTEX_VARIANT "condvar"
+#endif
+
+#define THREADS_MAX 64
+
+static queued_mutex_t mutex = QUEUED_MUTEX_INITIALIZER;
+static pthread_cond_t cond;
+static long counter, locks;
+
+static void* worker(void* context){
+    int sleeper = context != NULL;
+    for(long i = 0; i < locks; i++){
+        queued_mutex_lock(&mutex);
+        counter++;
+        for(volatile int k = 0; k < 50; k++);
+        if(sleeper && i % 1000 == 0)
+            queued_cond_nanosleep(&cond, &mutex, 1000);
+        queued_mutex_unlock(&mutex);
+        for(volatile int k = 0; k < 200; k++);
+    }
+    return NULL;
+}
+
+static int run(int threads){
+    pthread_t thread[THREADS_MAX];
+    struct rusage before, after;
+    struct timespec start, end;
+    counter = 0;
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < threads; i++)
+        pthread_create(thread + i, NULL, worker, i == 0 ? &cond : NULL);
+    for(int i = 0; i < threads; i++)
+        pthread_join(thread[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &after);
+
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    int ok = (counter == threads * locks);
+    printf("%-8s %2d threads: %8.1f ns/lock, %7ld voluntary and %7ld involuntary context switches%s\n",
+           MUTEX_VARIANT, threads, ns / (threads * locks),
+           after.ru_nvcsw - before.ru_nvcsw, after.ru_nivcsw - before.ru_nivcsw, ok ? "" : ", LOST UPDATES");
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char** argv){
+    locks = 100000;
+    int arg = 1;
+    if(arg + 1 < argc && !strcmp(argv[arg], "-n")){
+        locks = atol(argv[arg + 1]);
+        arg += 2;
+    }
+    if(locks < 1){
+        printf("Usage: %s [-n <locks per thread>] [<threads> ...]\n", argv[0]);
+        return 1;
+    }
+
+    // Same clock as cond_nanosleep() uses
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+
+    int res = 0;
+    if(arg == argc){
+        static const int defaults[] = { 1, 2, 4, 8, 16 };
+        for(size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+            res |= run(defaults[i]);
+    }
+    for(; arg < argc; arg++){
+        int threads = atoi(argv[arg]);
+        if(threads < 1 || threads > THREADS_MAX){
+            printf("Thread count must be between 1 and %d\n", THREADS_MAX);
+            return 1;
+        }
+        res |= run(threads);
+    }
+    return res ? 1 : 0;
+}
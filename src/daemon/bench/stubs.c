@@ -0,0 +1,168 @@
+// Stand-ins for the parts of the daemon that the benchmarks don't link: the USB and OS input layers, notifications
+// and firmware.
+
+#include "device.h"
+#include "devnode.h"
+#include "input.h"
+#include "usb.h"
+#include "stubs.h"
+
+// Event counts, so that different builds can be checked for doing the same work
+uint64_t keypresses, syncs, mousemoves, mousescrolls;
+uint64_t macrokeypresses;
+
+// OS input stubs
+void os_keypress(usbdevice* kb, int scancode, int down){
+    (void)scancode;
+    (void)down;
+    // macro_queue() stores the thread ID before the thread gets past mmutex2 in macro_thread()
+    if(kb->macrothread && pthread_equal(pthread_self(), *kb->macrothread))
+        macrokeypresses++;
+    else
+        keypresses++;
+}
+
+void os_mousemove(usbdevice* kb, int x, int y){
+    (void)kb;
+    (void)x;
+    (void)y;
+    mousemoves++;
+}
+
+void os_mousescroll(usbdevice* kb, int x, int y){
+    (void)kb;
+    (void)x;
+    (void)y;
+    mousescrolls++;
+}
+
+void os_inputsync_queued(usbdevice* kb, int s_kb, int m){
+    (void)kb;
+    (void)s_kb;
+    (void)m;
+}
+
+void os_inputsync(usbdevice* kb, int s_kb, int m){
+    (void)kb;
+    if(s_kb || m)
+        syncs++;
+}
+
+// Nothing below is reached by the benchmarks, but device.c, input.c and command.c need them to link
+
+int os_usb_control(usbdevice* kb, ctrltransfer* transfer, const char* file, int line){
+    (void)kb;
+    (void)transfer;
+    (void)file;
+    (void)line;
+    return 0;
+}
+
+int _usbsend(usbdevice* kb, void* messages, size_t msg_len, int count, const char* file, int line){
+    (void)kb;
+    (void)messages;
+    (void)msg_len;
+    (void)count;
+    (void)file;
+    (void)line;
+    return 0;
+}
+
+int _usbrecv(usbdevice* kb, void* out_msg, size_t msg_len, uchar* in_msg, const char* file, int line){
+    (void)kb;
+    (void)out_msg;
+    (void)msg_len;
+    (void)in_msg;
+    (void)file;
+    (void)line;
+    return 0;
+}
+
+int getfwversion(usbdevice* kb){
+    (void)kb;
+    return -1;
+}
+
+uint64_t usbdelay_clock(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void usbdelay_result(usbdevice* kb, delay_type_t type, int ok, uint64_t latency_ns){
+    (void)kb;
+    (void)type;
+    (void)ok;
+    (void)latency_ns;
+}
+
+int usb_tryreset(usbdevice* kb){
+    (void)kb;
+    return -1;
+}
+
+void usbdelay_reset(usbdevice* kb){
+    (void)kb;
+}
+
+void usbdelay_calibrate(usbdevice* kb){
+    (void)kb;
+}
+
+void usbdelay_stop(usbdevice* kb){
+    (void)kb;
+}
+
+int usbdelay_restore(usbdevice* kb, const char* scales){
+    (void)kb;
+    (void)scales;
+    return -1;
+}
+
+int mknotifynode(usbdevice* kb, int notify){
+    (void)kb;
+    (void)notify;
+    return -1;
+}
+
+int rmnotifynode(usbdevice* kb, int notify){
+    (void)kb;
+    (void)notify;
+    return -1;
+}
+
+int mkframenode(usbdevice* kb){
+    (void)kb;
+    return -1;
+}
+
+int rmframenode(usbdevice* kb){
+    (void)kb;
+    return -1;
+}
+
+void bragi_process_notification(usbdevice* kb, usbdevice* subkb, const uchar* const buffer){
+    (void)kb;
+    (void)subkb;
+    (void)buffer;
+}
+
+void nprintkey(usbdevice* kb, unsigned nodes, int keyindex, int down){
+    (void)kb;
+    (void)nodes;
+    (void)keyindex;
+    (void)down;
+}
+
+void nprintind(usbdevice* kb, int nnumber, int led, int on){
+    (void)kb;
+    (void)nnumber;
+    (void)led;
+    (void)on;
+}
+
+void timespec_add(struct timespec* timespec, int64_t nanoseconds){
+    nanoseconds += timespec->tv_nsec;
+    timespec->tv_sec += nanoseconds / 1000000000;
+    timespec->tv_nsec = nanoseconds % 1000000000;
+}
@@ -0,0 +1,11 @@
+#ifndef BENCH_STUBS_H
+#define BENCH_STUBS_H
+
+#include <stdint.h>
+
+// Calls to the os_* input functions, counted by the stubs in stubs.c
+extern uint64_t keypresses, syncs, mousemoves, mousescrolls;
+// Keypresses sent by a device's macro thread, which aren't included in keypresses
+extern uint64_t macrokeypresses;
+
+#endif  // BENCH_STUBS_H
@@ -3,9 +3,11 @@
 #include "includes.h"
 #include "device.h"
 #include "devnode.h"
+#include "keymap_patch.h"
 #include "led.h"
 #include "notify.h"
 #include "profile.h"
+#include "trace.h"
 #include "usb.h"
 #include <ckbnextconfig.h>
 
@@ -21,6 +23,8 @@ static const char* const cmd_strings[CMD_COUNT - 1] = {
     "notifyoff",
     "fps",
     "dither",
+    "frame",
+    "usbdelay",
 
     "hwload",
     "hwsave",
@@ -81,11 +85,169 @@ static inline long timespec_diff_ns (struct timespec* a, struct timespec* b){
 }
 #endif
 
+// A line from the command buffer, as seen by the superseded frame scan
+typedef struct {
+    char* start;
+    size_t len;
+    // Mode selected before the rgb word (0 if it wasn't changed since the start of the run)
+    int mode;
+    // "mode N" was given on this line
+    char setmode;
+    // Only contains an optional "mode N", followed by "rgb" and key:color parameters
+    char pure;
+    // Sets every key through a single hex constant
+    char full;
+    // Superseded by a later line
+    char drop;
+    // First parameter after "rgb"
+    char* params;
+} rgbline;
+
+static inline char* nexttoken(char* str, char* end, size_t* len){
+    while(str < end && *str == ' ')
+        str++;
+    char* tok = str;
+    while(str < end && *str != ' ')
+        str++;
+    *len = str - tok;
+    return tok;
+}
+
+// Parses a line and checks whether it's a plain rgb frame
+static void scan_rgbline(rgbline* l, int mode){
+    char* end = l->start + l->len;
+    size_t len;
+    char* tok = nexttoken(l->start, end, &len);
+    l->mode = mode;
+    l->pure = l->full = l->setmode = l->drop = 0;
+    if(len == 4 && !memcmp(tok, "mode", 4)){
+        tok = nexttoken(tok + len, end, &len);
+        int newmode;
+        if(sscanf(tok, "%d", &newmode) == 1 && newmode > 0 && newmode <= MODE_COUNT){
+            l->mode = newmode;
+            l->setmode = 1;
+        }
+        tok = nexttoken(tok + len, end, &len);
+    }
+    if(len != 3 || memcmp(tok, "rgb", 3))
+        return;
+    l->params = tok + len;
+    for(tok = nexttoken(l->params, end, &len); len; tok = nexttoken(tok + len, end, &len)){
+        if(memchr(tok, ':', len))
+            continue;
+        uint r, g, b;
+        if(len == 6 && sscanf(tok, "%02x%02x%02x", &r, &g, &b) == 3){
+            l->full = 1;
+            continue;
+        }
+        // Anything else is a different command
+        return;
+    }
+    l->pure = 1;
+}
+
+// Checks whether two rgb lines set exactly the same keys, ignoring the colors
+static int same_rgb_keys(const rgbline* a, const rgbline* b){
+    char* aend = a->start + a->len, *bend = b->start + b->len;
+    char* atok = a->params, *btok = b->params;
+    size_t alen, blen;
+    while(1){
+        atok = nexttoken(atok, aend, &alen);
+        btok = nexttoken(btok, bend, &blen);
+        if(!alen || !blen)
+            return alen == blen;
+        const char* acolon = memchr(atok, ':', alen);
+        const char* bcolon = memchr(btok, ':', blen);
+        if(!acolon || !bcolon || acolon - atok != bcolon - btok || memcmp(atok, btok, acolon - atok))
+            return 0;
+        atok += alen;
+        btok += blen;
+    }
+}
+
+///
+/// \brief skip_superseded_rgb Removes buffered rgb frames that are overwritten by a later frame
+/// \return number of frames that were dropped
+///
+/// When the client writes faster than the device can be updated, several complete frames pile up in the FIFO.
+/// Only the last one per mode is visible, so the others are replaced with a bare "rgb" (keeping any "mode N")
+/// before the buffer is tokenized. Only runs of consecutive rgb-only lines are considered.
+static int skip_superseded_rgb(char* buf){
+    int count = 1;
+    for(char* c = buf; (c = strchr(c, '\n')); c++)
+        count++;
+    if(count < 2)
+        return 0;
+    rgbline* lines = malloc(count * sizeof(rgbline));
+    if(!lines)
+        return 0;
+
+    // Split lines and track the selected mode through each run
+    char* start = buf;
+    int mode = 0;
+    for(int i = 0; i < count; i++){
+        char* nl = strchr(start, '\n');
+        lines[i].start = start;
+        lines[i].len = nl ? (size_t)(nl - start) : strlen(start);
+        scan_rgbline(lines + i, mode);
+        mode = lines[i].pure ? lines[i].mode : 0;
+        start += lines[i].len + 1;
+    }
+
+    // Walk backwards, remembering the next frame for each mode in the current run
+    int dropped = 0;
+    int next[MODE_COUNT + 1];
+    char nextfull[MODE_COUNT + 1];
+    for(int m = 0; m <= MODE_COUNT; m++)
+        next[m] = -1;
+    for(int i = count - 1; i >= 0; i--){
+        rgbline* l = lines + i;
+        if(!l->pure){
+            for(int m = 0; m <= MODE_COUNT; m++)
+                next[m] = -1;
+            continue;
+        }
+        int n = next[l->mode];
+        if(n >= 0 && (nextfull[l->mode] || same_rgb_keys(l, lines + n))){
+            l->drop = 1;
+            dropped++;
+        } else {
+            next[l->mode] = i;
+            nextfull[l->mode] = l->full;
+        }
+    }
+
+    // Compact the buffer
+    if(dropped){
+        char* out = buf;
+        for(int i = 0; i < count; i++){
+            rgbline* l = lines + i;
+            if(l->drop){
+                if(l->setmode)
+                    out += sprintf(out, "mode %d rgb", l->mode);
+                else
+                    out += sprintf(out, "rgb");
+            } else {
+                memmove(out, l->start, l->len);
+                out += l->len;
+            }
+            *out++ = (i == count - 1) ? '\0' : '\n';
+        }
+    }
+    free(lines);
+    return dropped;
+}
+
 int readcmd(usbdevice* kb, char* line){
+    TRACE1(readcmd_start, INDEX_OF(kb, keyboard));
 #ifdef FPS_COUNTER
     // workaround for being able to check if an rgb command was issued
     int rgb_cmd_count = 0;
 #endif
+    // Skip parsing frames that are going to be overwritten anyway
+    int dropped = skip_superseded_rgb(line);
+    if(dropped)
+        STATS_ADD(kb, rgb_dropped, dropped);
     const devcmd* vt = &kb->vtable;
     usbprofile* profile = kb->profile;
     usbmode* mode = profile->currentmode;
@@ -102,10 +264,12 @@ int readcmd(usbdevice* kb, char* line){
         for(int i = 0; i < CMD_COUNT - 1; i++){
             if(!strcmp(word, cmd_strings[i])){
                 command = i + CMD_FIRST;
+                if(command == RGB){
+                    STATS_ADD(kb, rgb_cmds, 1);
 #ifdef FPS_COUNTER
-                if(command == RGB)
                     rgb_cmd_count++;
 #endif
+                }
 #ifndef OS_MAC
                 // Layout and mouse acceleration aren't used on Linux; ignore
                 if(command == LAYOUT || command == ACCEL || command == SCROLLSPEED)
@@ -207,6 +371,28 @@ int readcmd(usbdevice* kb, char* line){
             }
             continue;
         }
+        case FRAME:
+            // Shared frame node on/off. Commits are only accepted while active.
+            if(!strcmp(word, "on")){
+                if(HAS_FEATURES(kb, FEAT_RGB))
+                    mkframenode(kb);
+                continue;
+            } else if(!strcmp(word, "off")){
+                rmframenode(kb);
+                continue;
+            }
+            break;
+        case USBDELAY:
+            // USB delay calibration: "calibrate", "stop", "reset" or previously calibrated scales
+            if(!strcmp(word, "calibrate"))
+                usbdelay_calibrate(kb);
+            else if(!strcmp(word, "stop"))
+                usbdelay_stop(kb);
+            else if(!strcmp(word, "reset"))
+                usbdelay_reset(kb);
+            else if(usbdelay_restore(kb, word))
+                ckb_warn("Invalid usbdelay argument %s", word);
+            continue;
         case DELAY: {
             continue;
         }
@@ -282,6 +468,15 @@ int readcmd(usbdevice* kb, char* line){
             }
             continue;
         }
+        case FRAME:
+            if(!strcmp(word, "commit")){
+                STATS_ADD(kb, rgb_cmds, 1);
+#ifdef FPS_COUNTER
+                rgb_cmd_count++;
+#endif
+                applyframe(kb, mode);
+            }
+            continue;
         case ERASEPROFILE:
             // Erase the current profile
             vt->eraseprofile(kb, mode, notifynumber, 0, 0);
@@ -344,12 +539,9 @@ int readcmd(usbdevice* kb, char* line){
                 vt->do_cmd[command](kb, mode, notifynumber, keycode, right);
             } else {
                 // Find this key in the keymap
-                for(unsigned i = 0; i < N_KEYS_EXTENDED; i++){
-                    if(kb->keymap[i].name && !strcmp(keyname, kb->keymap[i].name)){
-                        vt->do_cmd[command](kb, mode, notifynumber, i, right);
-                        break;
-                    }
-                }
+                int i = findkey(kb, keyname);
+                if(i >= 0)
+                    vt->do_cmd[command](kb, mode, notifynumber, i, right);
             }
             if(word[position += field] == ',')
                 position++;
@@ -376,5 +568,6 @@ int readcmd(usbdevice* kb, char* line){
         TRY_WITH_RESET(vt->updatedpi(kb, 0));
     }
 
+    TRACE1(readcmd_end, INDEX_OF(kb, keyboard));
     return 0;
 }
@@ -1,6 +1,9 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
+#include "os.h"
+#include <stdint.h>
+
 typedef struct usbdevice_ usbdevice;
 typedef struct usbmode_ usbmode;
 typedef enum pollrate_ pollrate_t;
@@ -9,22 +12,25 @@ typedef enum {
     DELAY_SEND,
     DELAY_RECV,
     DELAY_INDICATORS,
+    DELAY_TYPE_COUNT,
 } delay_type_t;
 
 // Command operations
 typedef enum {
     // Special - handled by readcmd, no device functions
-    NONE        = -11,
-    DELAY       = -10,   CMD_FIRST = DELAY,
-    MODE        = -9,
-    SWITCH      = -8,
-    LAYOUT      = -7,
-    ACCEL       = -6,
-    SCROLLSPEED = -5,
-    NOTIFYON    = -4,
-    NOTIFYOFF   = -3,
-    FPS         = -2,
-    DITHER      = -1,
+    NONE        = -13,
+    DELAY       = -12,   CMD_FIRST = DELAY,
+    MODE        = -11,
+    SWITCH      = -10,
+    LAYOUT      = -9,
+    ACCEL       = -8,
+    SCROLLSPEED = -7,
+    NOTIFYON    = -6,
+    NOTIFYOFF   = -5,
+    FPS         = -4,
+    DITHER      = -3,
+    FRAME       = -2,
+    USBDELAY    = -1,
 
     // Hardware data
     HWLOAD      = 0,    CMD_VT_FIRST = 0,
@@ -81,6 +87,7 @@ typedef void (*cmdhandler)(usbdevice* kb, usbmode* modeidx, int notifyidx, int k
 typedef int (*cmdhandler_io)(usbdevice* kb, usbmode* modeidx, int notifyidx, int keyindex, const char* parameter);  // Command with hardware I/O - returns zero on success
 typedef void (*cmdhandler_mac)(usbdevice* kb, usbmode* modeidx, int notifyidx, const char* keys, const char* assignment); // Macro command has a different left-side handler
 typedef int (*device_io)(usbdevice* kb, void* ptr, int len, int is_recv, const char* file, int line);
+typedef int (*device_io_batch)(usbdevice* kb, void* ptr, int len, int count, uint64_t* latency_ns, const char* file, int line);
 typedef union devcmd {
     // Commands can be accessed by name or by position
     cmdhandler      do_cmd[CMD_DEV_COUNT];
@@ -153,6 +160,8 @@ typedef union devcmd {
 
         device_io write;
         device_io read;
+        // Optional. Sends several packets at once and returns how many were sent successfully, along with their mean latency
+        device_io_batch write_batch;
 
         void (*get_battery_info)(usbdevice* kb);
         void (*delay)(usbdevice* kb, delay_type_t type);
@@ -5,18 +5,25 @@
 #include "usb.h"
 #include "input.h"
 #include "nxp_proto.h"
+#include "trace.h"
+#include <limits.h>
 
 // Device list
 usbdevice keyboard[DEV_MAX];    ///< remember all usb devices. Needed for closeusb().
 queued_mutex_t devmutex[DEV_MAX] = { [0 ... DEV_MAX-1] = QUEUED_MUTEX_INITIALIZER };        ///< Mutex for handling the usbdevice structure
 queued_mutex_t inputmutex[DEV_MAX] = { [0 ... DEV_MAX-1] = QUEUED_MUTEX_INITIALIZER };      ///< Mutex for dealing with usb input frames
 queued_mutex_t macromutex[DEV_MAX] = { [0 ... DEV_MAX-1] = QUEUED_MUTEX_INITIALIZER };      ///< Protecting macros against lightning: Both use usb_send
-pthread_mutex_t macromutex2[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_MUTEX_INITIALIZER };   ///< Protecting the single link list of threads and the macrovar
-pthread_cond_t macrovar[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_COND_INITIALIZER };        ///< This variable is used to stop and wakeup all macro threads which have to wait.
+pthread_mutex_t macromutex2[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_MUTEX_INITIALIZER };   ///< Protecting the macro queue and the macrovar
+pthread_cond_t macrovar[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_COND_INITIALIZER };        ///< Wakes up the macro scheduler when a macro is queued.
 pthread_cond_t macroint[DEV_MAX];                                                           ///< Should a macro thread's sleep be interrupted, due to repeated key press?
 pthread_mutex_t interruptmutex[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_MUTEX_INITIALIZER };///< Used for interrupt transfers
-pthread_cond_t interruptcond[DEV_MAX];                                                      ///< Same as above
+pthread_mutex_t urbbatchmutex[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_MUTEX_INITIALIZER }; ///< Used for batched OUT transfers
+pthread_cond_t urbbatchcond[DEV_MAX];                                                       ///< Same as above
 pthread_mutex_t childrenmutex[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_MUTEX_INITIALIZER };
+#ifndef OS_LINUX
+pthread_mutex_t intringmutex[DEV_MAX] = { [0 ... DEV_MAX-1] = PTHREAD_MUTEX_INITIALIZER };  ///< Wakes up intring_pop() where there are no futexes
+pthread_cond_t intringcond[DEV_MAX];                                                        ///< Same as above
+#endif
 
 ///
 /// \brief cond_nanosleep matches semantics of pthread_cond_timedwait, but with a relative wake time
@@ -39,9 +46,111 @@ int cond_nanosleep(pthread_cond_t *restrict cond,
 #endif
 }
 
+///
+/// \brief intring_push queues a response from the input thread without taking any locks.
+///
+/// The consumer only needs to be woken up if it said it's waiting. That is a futex wake on Linux, and a condition
+/// variable signal elsewhere, which is the only time the mutex is taken. Both sides use sequentially consistent accesses
+/// for tail/waiting, so either the producer sees the flag or the consumer sees the new tail before going to sleep.
+void intring_push(usbdevice* kb, const uchar* pkt, size_t len){
+    intring* ring = &kb->interruptring;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= INTRING_SIZE){
+        ckb_warn("ckb%d: Response queue full, dropping packet", INDEX_OF(kb, keyboard));
+        return;
+    }
+    memcpy(ring->pkt[tail % INTRING_SIZE], pkt, len);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)){
+#ifdef OS_LINUX
+        syscall(SYS_futex, &ring->tail, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+        // The consumer holds the mutex from setting waiting until it sleeps, so the signal can't arrive in between
+        pthread_mutex_lock(intringmutex + INDEX_OF(kb, keyboard));
+        pthread_cond_signal(intringcond + INDEX_OF(kb, keyboard));
+        pthread_mutex_unlock(intringmutex + INDEX_OF(kb, keyboard));
+#endif
+    }
+}
+
+int intring_pop(usbdevice* kb, uchar* pkt, size_t len, uint32_t ns){
+    intring* ring = &kb->interruptring;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    struct timespec deadline = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec_add(&deadline, ns);
+    uint32_t tail;
+    while((tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) == head){
+        struct timespec now = { 0 };
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t left = (int64_t)(deadline.tv_sec - now.tv_sec) * 1000000000 + (deadline.tv_nsec - now.tv_nsec);
+        if(left <= 0)
+            return ETIMEDOUT;
+#ifdef OS_LINUX
+        // The kernel only puts us to sleep if tail still has the value we checked, so a push can't be missed
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head){
+            struct timespec timeout = { .tv_sec = left / 1000000000, .tv_nsec = left % 1000000000 };
+            syscall(SYS_futex, &ring->tail, FUTEX_WAIT_PRIVATE, head, &timeout, NULL, 0);
+        }
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+#else
+        pthread_mutex_t* mutex = intringmutex + INDEX_OF(kb, keyboard);
+        pthread_mutex_lock(mutex);
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+            cond_nanosleep(intringcond + INDEX_OF(kb, keyboard), mutex, (uint32_t)left);
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(mutex);
+#endif
+    }
+    memcpy(pkt, ring->pkt[head % INTRING_SIZE], len);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void intring_flush(usbdevice* kb){
+    intring* ring = &kb->interruptring;
+    __atomic_store_n(&ring->head, __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+#if !defined(NO_FAIR_MUTEX_QUEUEING) && defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+// Waits until ticket is let in
+static void ticket_wait(queued_mutex_t* mutex, uint32_t ticket){
+    uint32_t* word = mutex->slot + ticket % QUEUED_MUTEX_SLOTS;
+    while(1){
+        // Read the slot before checking, so that an unlock in between makes the futex return right away
+        uint32_t seq = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&mutex->next_in, __ATOMIC_SEQ_CST) == ticket)
+            break;
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+    // Don't let anyone in while a thread in queued_cond_nanosleep() is between releasing the mutex and waiting on its
+    // condition variable, or a signal sent with the mutex held would be lost
+    if(__atomic_load_n(&mutex->sleepers, __ATOMIC_SEQ_CST)){
+        pthread_mutex_lock(&mutex->condmutex);
+        pthread_mutex_unlock(&mutex->condmutex);
+    }
+}
+
+// Lets the next ticket in
+static void ticket_next(queued_mutex_t* mutex){
+    uint32_t next = __atomic_load_n(&mutex->next_in, __ATOMIC_RELAXED) + 1;
+    __atomic_store_n(&mutex->next_in, next, __ATOMIC_SEQ_CST);
+    uint32_t* word = mutex->slot + next % QUEUED_MUTEX_SLOTS;
+    __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+    // Skip the syscall if nobody has taken that ticket yet. Whoever does will see next_in and go straight in
+    if(__atomic_load_n(&mutex->next_waiting, __ATOMIC_SEQ_CST) != next)
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
 void queued_mutex_lock(queued_mutex_t* mutex){
+    TRACE1(mutex_wait, mutex);
 #ifdef NO_FAIR_MUTEX_QUEUEING
     pthread_mutex_lock(mutex);
+#elif defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+    ticket_wait(mutex, __atomic_fetch_add(&mutex->next_waiting, 1, __ATOMIC_SEQ_CST));
 #else
     pthread_mutex_lock(&mutex->mutex);
     unsigned long my_turn = mutex->next_waiting++;
@@ -51,11 +160,19 @@ void queued_mutex_lock(queued_mutex_t* mutex){
 
     pthread_mutex_unlock(&mutex->mutex);
 #endif
+    TRACE1(mutex_acquired, mutex);
 }
 
 int queued_mutex_trylock(queued_mutex_t* mutex){
 #ifdef NO_FAIR_MUTEX_QUEUEING
     return pthread_mutex_trylock(mutex);
+#elif defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+    // Only take a ticket if it would be let in right away
+    uint32_t ticket = __atomic_load_n(&mutex->next_in, __ATOMIC_SEQ_CST);
+    if(!__atomic_compare_exchange_n(&mutex->next_waiting, &ticket, ticket + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return -1;
+    ticket_wait(mutex, ticket);
+    return 0;
 #else
     int res = 0;
     pthread_mutex_lock(&mutex->mutex);
@@ -76,6 +193,8 @@ int queued_mutex_trylock(queued_mutex_t* mutex){
 void queued_mutex_unlock(queued_mutex_t* mutex){
 #ifdef NO_FAIR_MUTEX_QUEUEING
     pthread_mutex_unlock(mutex);
+#elif defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+    ticket_next(mutex);
 #else
     pthread_mutex_lock(&mutex->mutex);
     mutex->next_in++;
@@ -95,6 +214,21 @@ void queued_cond_nanosleep(pthread_cond_t *restrict cond,
                            queued_mutex_t *restrict mutex, const uint32_t ns) {
 #ifdef NO_FAIR_MUTEX_QUEUEING
     cond_nanosleep(cond, mutex, ns);
+#elif defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+    pthread_mutex_lock(&mutex->condmutex);
+    __atomic_add_fetch(&mutex->sleepers, 1, __ATOMIC_SEQ_CST);
+
+    // release mutex. The next owner waits for condmutex, so it can't signal cond before we're waiting on it
+    ticket_next(mutex);
+
+    // perform the sleep
+    cond_nanosleep(cond, &mutex->condmutex, ns);
+
+    __atomic_sub_fetch(&mutex->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&mutex->condmutex);
+
+    // reacquire mutex
+    ticket_wait(mutex, __atomic_fetch_add(&mutex->next_waiting, 1, __ATOMIC_SEQ_CST));
 #else
     pthread_mutex_lock(&mutex->mutex);
 
@@ -128,9 +262,13 @@ int init_cond_monotonic(void) {
 
     // pthread_cond_init
     for(int i = 0 ; i < DEV_MAX ; i++) {
-        if(pthread_cond_init(&interruptcond[i], &monotonic_condattr) ||
-           pthread_cond_init(&macroint[i], &monotonic_condattr))
+        if(pthread_cond_init(&macroint[i], &monotonic_condattr) ||
+           pthread_cond_init(&urbbatchcond[i], &monotonic_condattr))
             return 1;
+#ifndef OS_LINUX
+        if(pthread_cond_init(&intringcond[i], &monotonic_condattr))
+            return 1;
+#endif
     }
 
     pthread_condattr_destroy(&monotonic_condattr);
@@ -299,5 +437,7 @@ void nxp_delay(usbdevice* kb, delay_type_t type){
         ckb_err("Invalid delay type %d", type);
         delay = 5000000L;
     }
+    if(type < DELAY_TYPE_COUNT && USBDELAY_SCALED(kb))
+        delay = delay * kb->delaycal.scale[type] / 100;
     clock_nanosleep(CLOCK_MONOTONIC, 0, &(struct timespec) {.tv_nsec = delay}, NULL);
 }
@@ -13,6 +13,21 @@ extern usbdevice keyboard[DEV_MAX];
 #ifdef NO_FAIR_MUTEX_QUEUEING
 #define QUEUED_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
 typedef pthread_mutex_t queued_mutex_t;
+#elif defined(FUTEX_FAIR_MUTEX) && defined(OS_LINUX)
+// A fair queue mutex construct; contenders get to grab the mutex in the order they attempted to acquire it
+// This is a ticket lock where each waiter sleeps on the futex word of its ticket's slot, so an unlock only wakes the next
+// waiter (and anyone whose ticket is a multiple of QUEUED_MUTEX_SLOTS away, who goes back to sleep) instead of all of them.
+#define QUEUED_MUTEX_SLOTS 16
+typedef struct queued_mutex{
+    uint32_t next_in, next_waiting;
+    // Incremented when the matching ticket is let in
+    uint32_t slot[QUEUED_MUTEX_SLOTS];
+    // Threads in queued_cond_nanosleep(), and the mutex for their condition variable
+    uint32_t sleepers;
+    pthread_mutex_t condmutex;
+} queued_mutex_t;
+
+#define QUEUED_MUTEX_INITIALIZER {0, 0, {0}, 0, PTHREAD_MUTEX_INITIALIZER}
 #else
 // A fair queue mutex construct; contenders get to grab the mutex in the order they attempted to acquire it
 typedef struct queued_mutex{
@@ -53,12 +68,21 @@ extern pthread_cond_t macrovar[DEV_MAX];
 extern pthread_cond_t macroint[DEV_MAX];
 #define mintvar(kb) (macroint + INDEX_OF(kb, keyboard))
 
-// Mutex used for transfering URB Interrupt data between threads
+// Mutex held from sending a request until its response has been read, so that only one thread at a time consumes interruptring
 extern pthread_mutex_t interruptmutex[DEV_MAX];
 #define intmutex(kb) (interruptmutex + INDEX_OF(kb, keyboard))
+
+// Lock-free queue between the input thread (producer) and the thread holding intmutex (consumer)
+void intring_push(usbdevice* kb, const uchar* pkt, size_t len);    // Drops the packet if the queue is full
+int intring_pop(usbdevice* kb, uchar* pkt, size_t len, uint32_t ns); // Returns 0 on success, ETIMEDOUT if nothing arrived in time
+void intring_flush(usbdevice* kb);                                  // Drops stale responses before sending a new request
+
+// Mutex used for handing batched OUT URB completions from the input thread back to the sender
+extern pthread_mutex_t urbbatchmutex[DEV_MAX];
+#define urbmutex(kb) (urbbatchmutex + INDEX_OF(kb, keyboard))
 // Pthread cond for the above
-extern pthread_cond_t interruptcond[DEV_MAX];
-#define intcond(kb) (interruptcond + INDEX_OF(kb, keyboard))
+extern pthread_cond_t urbbatchcond[DEV_MAX];
+#define urbcond(kb) (urbbatchcond + INDEX_OF(kb, keyboard))
 
 // Mutex to access the children for each device
 extern pthread_mutex_t childrenmutex[DEV_MAX];
@@ -114,6 +114,7 @@ const devcmd vtable_keyboard = {
     .fill_input_eps = nxp_fill_input_eps,
     .write = nxp_usb_write,
     .read = nxp_usb_read,
+    .write_batch = nxp_usb_write_batch,
     .get_battery_info = int0_void_none,
     .delay = nxp_delay,
     .setfps = nxp_kb_setfps,
@@ -167,6 +168,7 @@ const devcmd vtable_keyboard_wireless = {
     .fill_input_eps = nxp_fill_input_eps,
     .write = nxp_usb_write,
     .read = nxp_usb_read,
+    .write_batch = nxp_usb_write_batch,
     .get_battery_info = nxp_get_battery_info,
     .delay = nxp_delay,
     .setfps = nxp_kb_setfps,
@@ -275,6 +277,7 @@ const devcmd vtable_mouse = {
     .fill_input_eps = nxp_fill_input_eps,
     .write = nxp_usb_write,
     .read = nxp_usb_read,
+    .write_batch = nxp_usb_write_batch,
     .get_battery_info = int0_void_none,
     .delay = nxp_delay,
     .setfps = nxp_mouse_setfps,
@@ -328,6 +331,7 @@ const devcmd vtable_mouse_wireless = {
     .fill_input_eps = nxp_fill_input_eps,
     .write = nxp_usb_write,
     .read = nxp_usb_read,
+    .write_batch = nxp_usb_write_batch,
     .get_battery_info = nxp_get_battery_info,
     .delay = nxp_delay,
     .setfps = nxp_mouse_setfps,
@@ -382,6 +386,7 @@ const devcmd vtable_mousepad = {
     .fill_input_eps = nxp_fill_input_eps,
     .write = nxp_usb_write,
     .read = nxp_usb_read,
+    .write_batch = nxp_usb_write_batch,
     .get_battery_info = int0_void_none,
     .delay = nxp_delay,
     .setfps = nxp_mouse_setfps,
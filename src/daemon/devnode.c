@@ -5,7 +5,9 @@
 #include "led.h"
 #include "notify.h"
 #include "profile.h"
+#include "reactor.h"
 #include <ckbnextconfig.h>
+#include <sys/mman.h>
 
 // OSX doesn't like putting FIFOs in /dev for some reason
 // Don't make these pointers, as doing so will result in sizeof() not producing the correct result.
@@ -185,6 +187,144 @@ int rmnotifynode(usbdevice* kb, int notify){
     return res;
 }
 
+static int _mkframenode(usbdevice* kb){
+    if(kb->frame)
+        return 0;
+    char fpath[DEVPATH_LEN + 8];
+    snprintf(fpath, sizeof(fpath), "%s%d/frame", devpath, INDEX_OF(kb, keyboard));
+    int fd = open(fpath, O_RDWR | O_CREAT | O_TRUNC, gid >= 0 ? S_CUSTOM : S_READWRITE);
+    if(fd < 0){
+        ckb_warn("Unable to create %s: %s", fpath, strerror(errno));
+        return -1;
+    }
+    void* frame = MAP_FAILED;
+    if(ftruncate(fd, sizeof(ckb_frame)) != 0
+            || (frame = mmap(NULL, sizeof(ckb_frame), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+        ckb_warn("Unable to map %s: %s", fpath, strerror(errno));
+        close(fd);
+        remove(fpath);
+        return -1;
+    }
+    // The umask is 0, but open() doesn't guarantee the mode on an existing file
+    if(fchmod(fd, gid >= 0 ? S_CUSTOM : S_READWRITE) < 0)
+        ckb_warn("FChmod call failed %s: %s", fpath, strerror(errno));
+    check_fchown(fd, 0, gid);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    kb->frame = frame;
+    kb->frame_seq = 0;
+    kb->frame->count = N_KEYS_EXTENDED;
+    for(int i = 0; i < N_KEYS_EXTENDED; i++){
+        if(kb->keymap[i].name)
+            strncpy(kb->frame->name[i], kb->keymap[i].name, FRAME_NAME_LEN - 1);
+    }
+    // Start from the current colors so that keys the client doesn't know about are left alone
+    if(kb->profile){
+        const lighting* light = &kb->profile->currentmode->light;
+        for(int i = 0; i < N_KEYS_EXTENDED; i++){
+            short led = kb->keymap[i].led;
+            if(led < 0)
+                continue;
+            kb->frame->r[i] = light->r[led];
+            kb->frame->g[i] = light->g[led];
+            kb->frame->b[i] = light->b[led];
+        }
+    }
+    // Write the magic last, clients check it before using the node
+    __atomic_store_n(&kb->frame->magic, FRAME_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int mkframenode(usbdevice* kb){
+    euid_guard_start;
+    int res = _mkframenode(kb);
+    euid_guard_stop;
+    return res;
+}
+
+static int _rmframenode(usbdevice* kb){
+    if(!kb->frame)
+        return -1;
+    munmap(kb->frame, sizeof(ckb_frame));
+    kb->frame = NULL;
+    char fpath[DEVPATH_LEN + 8];
+    snprintf(fpath, sizeof(fpath), "%s%d/frame", devpath, INDEX_OF(kb, keyboard));
+    return remove(fpath);
+}
+
+int rmframenode(usbdevice* kb){
+    euid_guard_start;
+    int res = _rmframenode(kb);
+    euid_guard_stop;
+    return res;
+}
+
+static int _mkstatsnode(usbdevice* kb){
+    char spath[DEVPATH_LEN + 8];
+    snprintf(spath, sizeof(spath), "%s%d/stats", devpath, INDEX_OF(kb, keyboard));
+    FILE* sfile = fopen(spath, "w");
+    if(!sfile){
+        ckb_warn("Unable to create %s: %s", spath, strerror(errno));
+        remove(spath);
+        return -1;
+    }
+    const devstats* stats = &kb->stats;
+    fprintf(sfile, "rgb_cmds %"PRIu64"\n", stats->rgb_cmds);
+    fprintf(sfile, "rgb_dropped %"PRIu64"\n", stats->rgb_dropped);
+    fprintf(sfile, "frames_skipped %"PRIu64"\n", stats->frames_skipped);
+    fprintf(sfile, "usb_writes %"PRIu64"\n", stats->usb_writes);
+    fprintf(sfile, "usb_bytes %"PRIu64"\n", stats->usb_bytes);
+    fprintf(sfile, "usb_retries %"PRIu64"\n", stats->usb_retries);
+    fprintf(sfile, "usb_resets %"PRIu64"\n", stats->usb_resets);
+    fprintf(sfile, "input_urbs %"PRIu64"\n", stats->input_urbs);
+    fprintf(sfile, "notify_dropped %"PRIu64"\n", stats->notify_dropped);
+    // Percentiles are reported as the upper bound of the histogram bucket they fall in
+    uint64_t total = 0;
+    int max = -1;
+    for(int i = 0; i < STATS_LATENCY_BUCKETS; i++){
+        total += stats->send_latency[i];
+        if(stats->send_latency[i])
+            max = i;
+    }
+    static const int percentiles[] = { 50, 90, 99 };
+    int p = 0;
+    uint64_t count = 0;
+    for(int i = 0; i <= max && p < 3; i++){
+        count += stats->send_latency[i];
+        while(p < 3 && count * 100 >= total * percentiles[p])
+            fprintf(sfile, "send_latency_p%d_us %llu\n", percentiles[p++], 1ULL << i);
+    }
+    if(max >= 0)
+        fprintf(sfile, "send_latency_max_us %llu\n", 1ULL << max);
+    fclose(sfile);
+    check_chmod(spath, S_GID_READ);
+    check_chown(spath, 0, gid);
+    kb->stats.dirty = 0;
+    return 0;
+}
+
+int mkstatsnode(usbdevice* kb){
+    euid_guard_start;
+    int res = _mkstatsnode(kb);
+    euid_guard_stop;
+    return res;
+}
+
+void refresh_statsnodes(){
+    for(int i = 1; i < DEV_MAX; i++){
+        usbdevice* kb = keyboard + i;
+        if(!kb->stats.dirty)
+            continue;
+        // Don't hold up the main loop behind a device that is busy sending, its stats will be picked up next time
+        if(queued_mutex_trylock(dmutex(kb)))
+            continue;
+        if(kb->status == DEV_STATUS_CONNECTED)
+            mkstatsnode(kb);
+        queued_mutex_unlock(dmutex(kb));
+    }
+}
+
 static void printnode(const char* path, const char* str){
     FILE* file = fopen(path, "w");
     if(file){
@@ -351,6 +491,7 @@ static int _mkdevpath(usbdevice* kb){
         }
         // Write firmware version and poll rate
         mkfwnode(kb);
+        _mkstatsnode(kb);
     }
     return 0;
 }
@@ -367,6 +508,9 @@ int rmdevpath(usbdevice* kb){
     int index = INDEX_OF(kb, keyboard);
     if(kb->infifo != 0){
         int fd = kb->infifo - 1;
+#ifdef OS_LINUX
+        reactor_del(&mainreactor, fd);
+#endif
 #ifdef OS_MAC
         fcntl(fd, F_SETFL, O_RDWR | O_NONBLOCK); // hack to prevent the following hack from blocking if the GUI was running
 #endif
@@ -377,6 +521,7 @@ int rmdevpath(usbdevice* kb){
     }
     for(int i = 0; i < OUTFIFO_MAX; i++)
         _rmnotifynode(kb, i);
+    _rmframenode(kb);
     char path[DEVPATH_LEN + 2];
     snprintf(path, sizeof(path), "%s%d", devpath, index);
     if(rm_recursive(path) != 0 && errno != ENOENT){
@@ -33,9 +33,21 @@ int mknotifynode(usbdevice* kb, int notify);
 /// Removes a notification node for the specified keyboard.
 int rmnotifynode(usbdevice* kb, int notify);
 
+/// Creates the shared frame node for the specified keyboard and maps it to kb->frame.
+int mkframenode(usbdevice* kb);
+
+/// Unmaps and removes the shared frame node for the specified keyboard.
+int rmframenode(usbdevice* kb);
+
 /// Writes a keyboard's firmware version and poll rate to its device node.
 int mkfwnode(usbdevice* kb);
 
+/// Writes a keyboard's runtime statistics to its stats node.
+int mkstatsnode(usbdevice* kb);
+
+/// Rewrites the stats node of every connected device whose statistics changed. Called once per second from the main loop.
+void refresh_statsnodes();
+
 /// Custom readline is needed for FIFOs. fopen()/getline() will die if the data is sent in too fast.
 #define MAX_BUFFER (1024 * 128)
 typedef struct {
@@ -3,7 +3,9 @@
 #include <limits.h>
 #include "device.h"
 #include "input.h"
+#include "keymap_patch.h"
 #include "notify.h"
+#include "trace.h"
 #include <assert.h>
 
 #define IS_SCROLLWHEEL_V(scan)  ((scan) == BTN_WHEELUP   || (scan) == BTN_WHEELDOWN)
@@ -19,168 +21,105 @@ static int macromask(const uchar* keys, const uchar* macro){
     return 1;
 }
 
-///
-/// \brief pt_head is the head pointer for the single linked thread list managed by macro_pt_en/dequeue().
-static ptlist_t* pt_head = 0;
-/// \brief pt_tail is the tail pointer for the single linked thread list managed by macro_pt_en/dequeue().
-static ptlist_t* pt_tail = 0;
-
-// FIXME: Most of the following macro queueing code is wrong.
-// We can't assume pthread_t is an arithmetic type, so assigning it to 0 is incorrect.
-
-///
-/// \brief macro_pt_enqueue Save the new thread in the single linked list (FIFO).
-/// \attention Becuase multiple threads may use this function in parallel,
-/// save the critical section with a mutex.
-///
-static void macro_pt_enqueue() {
-    ptlist_t* new_elem = malloc(sizeof(ptlist_t));
-    if (!new_elem) {
-        perror("macro_pt_enqueue: ");
-        exit (-1);  ///< exit on critical situation; \todo find a better exit strategy if no more mem available.
-    }
-    new_elem->next = 0;
-    new_elem->thread_id = pthread_self();   ///< The element knows its ID byself
-    if (pt_head == 0) {
-        pt_head = pt_tail = new_elem;       ///< new list, first element
-    } else {
-        pt_tail->next = new_elem;           ///< existing list, append on last element (FIFO)
-        pt_tail = new_elem;
-    }
-}
-
-///
-/// \brief macro_pt_dequeue gets the first thread id of the list and returns the thread_id stored in it.
-/// \return the ptread_id of the first element. If list is empty, return 0.
-/// \attention Becuase multiple threads may use this function in parallel,
-/// save the critical section with a mutex.
-///
-static pthread_t macro_pt_dequeue() {
-    pthread_t retval = 0;
-    ptlist_t* elem = 0;
-    if (pt_head == 0 && pt_tail == 0) {
-        ckb_err("macro_pt_dequeue: called on empty list.");
-        return 0;       ///< why are we called?
-    }
-    elem = pt_head;
-    pt_head = pt_head->next;
-    if (pt_head == 0) pt_tail = 0;      ///< Was last element in the list, so clear tail.
-    retval = elem->thread_id;           ///< save the return value before deleting element
-    free(elem);
-    return retval;
-}
-
-///
-/// \brief macro_pt_first returns the first pthread_id but does not remove the first entry.
-/// \return the pthread_id of the first element in the list or 0 if list is empty.
-/// \attention Becuase multiple threads may use this function in parallel,
-/// save the critical section with a mutex (avoid NIL-ptr)
-///
-static pthread_t macro_pt_first() {
-    return pt_head? pt_head->thread_id : 0;
-}
-
 // Default macro keystroke delay
 const struct timespec macrodelay = { .tv_nsec = 1000000 };
+int macro_coalesce = 0;
 // Initial repeat delay
 #define DELAY_REPEAT_INITIAL 500000000
 // Delay for every subsequent repeat
 #define DELAY_REPEAT_CATCHUP 500000000
 
-static inline void clock_microsleep(uint32_t s) {
-    const struct timespec ts = {
-        .tv_sec = s / 1000000,
-        .tv_nsec = (s % 1000000) * 1000,
-    };
-    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+// Sleep until the given amount of time has passed since the previous deadline.
+// Using absolute deadlines keeps the time spent sending events from adding up over a long macro.
+// Time lost elsewhere (e.g. waiting for mmutex behind an RGB transfer) isn't caught up on by sending the next actions
+// back to back though, as applications drop keys that come in too fast. There's always at least macrodelay
+// (or the requested delay, if shorter) from now.
+static inline void macro_sleep(struct timespec* deadline, int64_t ns) {
+    struct timespec earliest;
+    clock_gettime(CLOCK_MONOTONIC, &earliest);
+    timespec_add(&earliest, ns < macrodelay.tv_nsec ? ns : macrodelay.tv_nsec);
+    timespec_add(deadline, ns);
+    if(timespec_lt(*deadline, earliest))
+        *deadline = earliest;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
 }
 
 ///
-/// \brief play_macro is the code for all threads started to play a macro.
-/// \param param \a macro_param to store Kb-ptr and macro-ptr (thread may get only one user-parameter)
-/// \return 0 on success, -1 else (no one is interested in it except the kernel...)
+/// \brief macro_finish frees a macro that has finished playing, or never got to play. Lock imutex first.
 ///
-static void* play_macro(void* param) {
-    macro_param* ptr = param;
+static void macro_finish(macro_param* param) {
+    // If the binding was freed in the meantime, we are responsible for freeing the code
+    if (param->abort)
+        free(param->code);
+    else
+        param->macro->param = NULL;
+    free(param);
+}
+
+///
+/// \brief play_macro plays a macro on the scheduler thread, including its repeats while the keys are held down.
+/// \param ptr the queued macro. It is freed before returning.
+///
+static void play_macro(macro_param* ptr) {
     usbdevice* kb = ptr->kb;
     keymacro* macro = ptr->macro;
 
-#ifdef OS_MAC
-    pthread_setname_np("ckb macro");
-#endif // OS_MAC
-
-    /// First have a look if we are the first and only macro-thread to run. If not, wait.
-    /// So enqueue our thread first, so it is remembered for us and can be seen by all others.
-    pthread_mutex_lock(mmutex2(kb));
-    macro_pt_enqueue();
-    // ckb_info("Entering critical section with 0x%lx. Queue head is 0x%lx",  (unsigned long int)pthread_self(), (unsigned long int)macro_pt_first());
-    while (macro_pt_first() != pthread_self()) {    ///< If the first thread in the list is not our, another one is running
-        // ckb_info("Now waiting with 0x%lx because of 0x%lx", (unsigned long int)pthread_self(), (unsigned long int)macro_pt_first());
-        pthread_cond_wait(mvar(kb), mmutex2(kb));
-        // ckb_info("Waking up with 0x%lx", (unsigned long int)pthread_self());
-    }
-    pthread_mutex_unlock(mmutex2(kb));       ///< Give all new threads the chance to enter the block.
-
     /*
      * Is this the first time the macro is being repeated due to the key being
      * held down continuously?
      */
     int first_keydownloop = 1;
     while(1){
-        /// Send events for each keypress in the macro
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        /// Run the compiled macro. Events are only written out before sleeping, so actions without a delay go out together
         queued_mutex_lock(mmutex(kb)); ///< Synchonization between macro output and color information
-        for (int a = 0; a < ptr->actioncount; a++) {
-            macroaction* action = ptr->actions + a;
-            if (action->rel_x != 0 || action->rel_y != 0){
-                os_mousemove(kb, action->rel_x, action->rel_y);
-                os_inputsync(kb, 0, 1);
-            } else {
-                if(IS_SCROLLWHEEL_V(action->scan)) {
-                    if(action->down)
-                        os_mousescroll(kb, 0, (action->scan == BTN_WHEELUP ? 1 : -1));
-                } else if(IS_SCROLLWHEEL_H(action->scan)) {
-                    if(action->down)
-                        os_mousescroll(kb, (action->scan == BTN_WHEELLEFT ? -1 : 1), 0);
-                } else {
-                    os_keypress(kb, action->scan, action->down);
-                }
-                int sync_mouse = action->scan & SCAN_MOUSE;
-                os_inputsync(kb, !sync_mouse, sync_mouse);
-
+        for (int i = 0; i < ptr->codelen && !kb->shutdown_macrothread; i++) {
+            const macroinsn* insn = ptr->code + i;
+            TRACE2(macro_action, INDEX_OF(kb, keyboard), insn->op);
+            switch (insn->op) {
+            case MACRO_KEY:
+                os_keypress(kb, insn->key.scan, insn->key.down);
+                break;
+            case MACRO_SCROLL:
+                os_mousescroll(kb, insn->rel.x, insn->rel.y);
+                break;
+            case MACRO_MOVE:
+                os_mousemove(kb, insn->rel.x, insn->rel.y);
+                break;
+            case MACRO_SYNC:
+                os_inputsync_queued(kb, insn->sync.kb, insn->sync.mouse);
+                break;
+            case MACRO_SLEEP:
+                os_inputsync(kb, 0, 0);
                 queued_mutex_unlock(mmutex(kb));           ///< use this unlock / relock for enablling the parallel running colorization
-                if (action->delay != UINT32_MAX && action->delay) {    ///< local delay set
-                    if(action->delay_max) {
-                        // Generate a random delay in the range requested
-                        // First, we need a random number that can be as large as uint32_t
-                        // RAND_MAX can be as low as 0x7fff
-                        uint16_t second = rand() & 0x7fff;
-                        uint16_t first = rand() & 0x7fff;
-                        uint32_t final = ((uint32_t)first << 17);
-                        final |= (second << 1);
-                        // Now that we have a sufficently large random number, range it appropriately
-                        final = ((uint64_t)action->delay + (uint64_t)final) % (action->delay_max - action->delay);
-                        clock_microsleep(final);
-                    } else {
-                        clock_microsleep(action->delay);
-                    }
+                if(insn->sleep.delay_max) {
+                    // Generate a random delay in the range requested
+                    // First, we need a random number that can be as large as uint32_t
+                    // RAND_MAX can be as low as 0x7fff
+                    uint16_t second = rand() & 0x7fff;
+                    uint16_t first = rand() & 0x7fff;
+                    uint32_t final = ((uint32_t)first << 17);
+                    final |= (second << 1);
+                    // Now that we have a sufficently large random number, range it appropriately
+                    final = ((uint64_t)insn->sleep.delay + (uint64_t)final) % (insn->sleep.delay_max - insn->sleep.delay);
+                    macro_sleep(&deadline, final * 1000LL);
                 } else {
-                    clock_nanosleep(CLOCK_MONOTONIC, 0, &macrodelay, NULL);
+                    macro_sleep(&deadline, insn->sleep.delay * 1000LL);
                 }
                 queued_mutex_lock(mmutex(kb));
+                break;
             }
         }
-
+        os_inputsync(kb, 0, 0);
         queued_mutex_unlock(mmutex(kb));
 
         int delay_ns = first_keydownloop ? DELAY_REPEAT_INITIAL : DELAY_REPEAT_CATCHUP;
 
         queued_mutex_lock(imutex(kb));
-        // detect if the macro playback has been aborted
-        if (ptr->abort) {
-            // we are responsible for free-ing actions.
-            free(ptr->actions);
+        // detect if the macro playback has been aborted, or the device is going away
+        if (ptr->abort || kb->shutdown_macrothread)
             break;
-        }
 
         if (macro->triggered > 1) {
             macro->triggered -= 2;
@@ -210,23 +149,102 @@ static void* play_macro(void* param) {
 
         queued_mutex_unlock(imutex(kb));
     }
-    if (!ptr->abort)
-        macro->param = NULL;
+    macro_finish(ptr);
     queued_mutex_unlock(imutex(kb));
+}
 
-    queued_mutex_lock(mmutex(kb));
+///
+/// \brief macro_thread is the per-device macro scheduler. Triggered macros are queued on kb->macroqueue_head
+/// and played here one after another, so triggering a macro never has to create a thread.
+/// Only the macros of one device are serialized this way, macros on different devices play at the same time.
+///
+static void* macro_thread(void* context) {
+    usbdevice* kb = context;
 
-    pthread_mutex_lock(mmutex2(kb));    ///< protect the linked list and the mvar
-    // ckb_info("Now leaving 0x%lx and waking up all others", (unsigned long int)pthread_self());
-    macro_pt_dequeue();
-    pthread_cond_broadcast(mvar(kb));   ///< Wake up all waiting threads
-    pthread_mutex_unlock(mmutex2(kb));  ///< for the linked list and the mvar
+#ifdef OS_MAC
+    pthread_setname_np("ckb macro");
+#endif // OS_MAC
 
-    queued_mutex_unlock(mmutex(kb));   ///< Sync keyboard input/output and colorization
-    free(param);
+    pthread_mutex_lock(mmutex2(kb));
+    while (!kb->shutdown_macrothread) {
+        macro_param* param = kb->macroqueue_head;
+        if (!param) {
+            pthread_cond_wait(mvar(kb), mmutex2(kb));
+            continue;
+        }
+        kb->macroqueue_head = param->next;
+        if (!kb->macroqueue_head)
+            kb->macroqueue_tail = NULL;
+        pthread_mutex_unlock(mmutex2(kb));
+        play_macro(param);
+        pthread_mutex_lock(mmutex2(kb));
+    }
+    pthread_mutex_unlock(mmutex2(kb));
+    return 0;
+}
+
+///
+/// \brief macro_queue hands a triggered macro to the device's scheduler, starting it if needed. Lock imutex first.
+/// \return 0 on success, -1 if the scheduler couldn't be started
+///
+static int macro_queue(usbdevice* kb, macro_param* param) {
+    pthread_mutex_lock(mmutex2(kb));
+    if (!kb->macrothread) {
+        kb->macrothread = malloc(sizeof(pthread_t));
+        if (!kb->macrothread || pthread_create(kb->macrothread, 0, macro_thread, kb)) {
+            ckb_err("ckb%d: Failed to create macro thread", INDEX_OF(kb, keyboard));
+            free(kb->macrothread);
+            kb->macrothread = NULL;
+            pthread_mutex_unlock(mmutex2(kb));
+            return -1;
+        }
+#ifndef OS_MAC
+        // name this thread externally if not on mac,
+        // on mac `pthread_setname_np` is only naming the current thread
+        char macrothread_name[THREAD_NAME_MAX] = "ckbX macro";
+        macrothread_name[3] = INDEX_OF(kb, keyboard) + '0';
+        pthread_setname_np(*kb->macrothread, macrothread_name);
+#endif // OS_MAC
+    }
+    param->next = NULL;
+    if (kb->macroqueue_tail)
+        kb->macroqueue_tail->next = param;
+    else
+        kb->macroqueue_head = param;
+    kb->macroqueue_tail = param;
+    pthread_cond_signal(mvar(kb));
+    pthread_mutex_unlock(mmutex2(kb));
     return 0;
 }
 
+void macro_stopthread(usbdevice* kb) {
+    if (!kb->macrothread)
+        return;
+    pthread_mutex_lock(mmutex2(kb));
+    kb->shutdown_macrothread = 1;
+    pthread_cond_broadcast(mvar(kb));
+    pthread_mutex_unlock(mmutex2(kb));
+    // Wake it up from a repeat delay or an action delay, and let it finish with imutex
+    pthread_cond_broadcast(mintvar(kb));
+    queued_mutex_unlock(imutex(kb));
+    queued_mutex_unlock(dmutex(kb));
+    pthread_kill(*kb->macrothread, SIGUSR2);
+    pthread_join(*kb->macrothread, NULL);
+    queued_mutex_lock(dmutex(kb));
+    queued_mutex_lock(imutex(kb));
+    free(kb->macrothread);
+    kb->macrothread = NULL;
+    kb->shutdown_macrothread = 0;
+
+    // Drop anything that didn't get to play
+    macro_param* param;
+    while ((param = kb->macroqueue_head)) {
+        kb->macroqueue_head = param->next;
+        macro_finish(param);
+    }
+    kb->macroqueue_tail = NULL;
+}
+
 // Checks if the macro mask contains any wheels to prevent it from looping endlessly
 static inline int is_wheel_keybit(const usbdevice* kb, const uchar* macro){
     for(int i = 0; i < N_KEYBYTES_INPUT; i++){
@@ -282,7 +300,7 @@ static inline void inputupdate_keys(usbdevice* kb, int* sync_kb, int* sync_mouse
             }
 
             if (macro->triggered <= 3) {
-                // start up a thread if there isn't already one running
+                // queue it up if it isn't already queued or playing
                 if (!macro->param) {
                     // assert(macro->triggered == 1)
                     macro_param* params = malloc(sizeof(macro_param));
@@ -291,28 +309,18 @@ static inline void inputupdate_keys(usbdevice* kb, int* sync_kb, int* sync_mouse
                     } else {
                         params->kb = kb;
                         params->macro = macro;
-                        params->actions = macro->actions;
-                        params->actioncount = macro->actioncount;
+                        params->code = macro->code;
+                        params->codelen = macro->codelen;
                         params->abort = 0;
                         macro->param = params;
-                        pthread_t thread;
-                        int retval = pthread_create(&thread, 0, play_macro, params);
-                        if (retval) {
+                        if (macro_queue(kb, params)) {
                             macro->triggered = 0;
                             macro->param = NULL;
-                            perror("inputupdate_keys: Creating thread returned not null");
-                        } else {
-                            pthread_detach(thread);
-
-#ifndef OS_MAC
-                            // name thread externally if it was created on non-mac systems
-                            // ignore the result
-                            pthread_setname_np(thread, "ckb macro");
-#endif // OS_MAC
+                            free(params);
                         }
                     }
                 } else {
-                    // if there is already a thread running, it may be waiting for DELAY_REPEAT_*
+                    // if it is already playing, it may be waiting for DELAY_REPEAT_*
                     // it does not need to wait anymore
                     pthread_cond_broadcast(mintvar(kb));
                 }
@@ -422,22 +430,25 @@ static inline void inputupdate_keys(usbdevice* kb, int* sync_kb, int* sync_mouse
 
                 // Print notifications if desired
                 if(kb->active){
+                    unsigned nodes = 0;
                     for(int notify = 0; notify < OUTFIFO_MAX; notify++){
-                        if(mode->notify[notify][byte] & mask){
-                            // Wheels don't generate keyups and additionally can produce multiple events
-                            // with a single report. No device so far supports scrolling horizontally,
-                            // so only vertical notifications are implemented.
-                            if(IS_SCROLLWHEEL_V(map->scan)){
-                                for(int i = 0; i < abs(input->whl_rel_y); i++){
-                                    nprintkey(kb, notify, keyindex, 1);
-                                    nprintkey(kb, notify, keyindex, 0);
-                                }
-                            } else if(IS_VOLWHEEL(map->scan)){
-                                    nprintkey(kb, notify, keyindex, 1);
-                                    nprintkey(kb, notify, keyindex, 0);
-                            } else {
-                                nprintkey(kb, notify, keyindex, new);
+                        if(mode->notify[notify][byte] & mask)
+                            nodes |= 1U << notify;
+                    }
+                    if(nodes){
+                        // Wheels don't generate keyups and additionally can produce multiple events
+                        // with a single report. No device so far supports scrolling horizontally,
+                        // so only vertical notifications are implemented.
+                        if(IS_SCROLLWHEEL_V(map->scan)){
+                            for(int i = 0; i < abs(input->whl_rel_y); i++){
+                                nprintkey(kb, nodes, keyindex, 1);
+                                nprintkey(kb, nodes, keyindex, 0);
                             }
+                        } else if(IS_VOLWHEEL(map->scan)){
+                                nprintkey(kb, nodes, keyindex, 1);
+                                nprintkey(kb, nodes, keyindex, 0);
+                        } else {
+                            nprintkey(kb, nodes, keyindex, new);
                         }
                     }
                 }
@@ -474,6 +485,7 @@ void inputupdate(usbdevice* kb){
 #endif
             || !kb->profile)
         return;
+    TRACE1(input_update, INDEX_OF(kb, keyboard));
 
     usbinput* input = &kb->input;
     int sync_kb = 0;
@@ -506,6 +518,7 @@ void inputupdate(usbdevice* kb){
     memcpy(input->prevkeys, input->keys, N_KEYBYTES_INPUT);
     input->whl_rel_x = input->whl_rel_y = 0;
     os_inputsync(kb, sync_kb, sync_mouse);
+    TRACE3(input_sync, INDEX_OF(kb, keyboard), sync_kb, sync_mouse);
 }
 
 void updateindicators_kb(usbdevice* kb, int force){
@@ -532,8 +545,10 @@ void updateindicators_kb(usbdevice* kb, int force){
         ctrltransfer transfer = { .bRequestType = 0x21, .bRequest = 0x09, .wValue = 0x0200, .wIndex = 0, .wLength = len, .timeout = 5000, .data = &leds };
         if(kb->protocol == PROTO_BRAGI)
             transfer.wValue++;
-        os_usb_control(kb, &transfer, __FILE_NOPATH__, __LINE__);
+        uint64_t start = usbdelay_clock();
+        int res = os_usb_control(kb, &transfer, __FILE_NOPATH__, __LINE__);
         queued_mutex_lock(dmutex(kb));
+        usbdelay_result(kb, DELAY_INDICATORS, res > 0, usbdelay_clock() - start);
     }
     // Print notifications if desired
     if(!kb->active)
@@ -552,14 +567,80 @@ void updateindicators_kb(usbdevice* kb, int force){
 }
 
 ///
-/// \brief destroymacro free actions if macro is not currently running
+/// \brief destroymacro free code if macro is not currently running
 /// \param macro
 ///
 static inline void destroymacro(keymacro* macro) {
     if (macro->param)
         macro->param->abort = 1;
     else
-        free(macro->actions);
+        free(macro->code);
+}
+
+///
+/// \brief macro_compile turns parsed macro actions into the instructions run by play_macro()
+///
+/// Every action is followed by a sync and a sleep, like it was sent on its own. The exceptions are actions with an
+/// explicit delay of 0: their events are merged into the next input report, and they are written out together
+/// with the following actions. A sync is still forced before a scancode shows up twice in the same report.
+/// Note that this changes how "=0" plays: the old player waited macrodelay after those actions, same as the default.
+///
+/// With macro_coalesce set, actions using the default delay still get a report of their own, but no sleep,
+/// so a run of them goes out with a handful of writes instead of one write and one macrodelay per action.
+/// \return the number of instructions written to code, which needs room for actioncount * 3 + 1 of them
+///
+static int macro_compile(const macroaction* actions, int actioncount, macroinsn* code) {
+    int len = 0, report_start = 0;
+    char sync_kb = 0, sync_mouse = 0;
+    for (int a = 0; a < actioncount; a++) {
+        const macroaction* action = actions + a;
+        if (action->rel_x != 0 || action->rel_y != 0) {
+            // Mouse movement is never followed by a delay
+            code[len++] = (macroinsn){ .op = MACRO_MOVE, .rel = { action->rel_x, action->rel_y } };
+            sync_mouse = 1;
+            continue;
+        }
+        if (IS_SCROLLWHEEL_V(action->scan) || IS_SCROLLWHEEL_H(action->scan)) {
+            if (action->down) {
+                short x = 0, y = 0;
+                if (IS_SCROLLWHEEL_V(action->scan))
+                    y = (action->scan == BTN_WHEELUP ? 1 : -1);
+                else
+                    x = (action->scan == BTN_WHEELLEFT ? -1 : 1);
+                code[len++] = (macroinsn){ .op = MACRO_SCROLL, .rel = { x, y } };
+            }
+        } else {
+            // Force a sync if this key is already in the current report
+            for (int i = report_start; i < len; i++) {
+                if (code[i].op == MACRO_KEY && code[i].key.scan == action->scan) {
+                    code[len++] = (macroinsn){ .op = MACRO_SYNC, .sync = { sync_kb, sync_mouse } };
+                    sync_kb = sync_mouse = 0;
+                    report_start = len;
+                    break;
+                }
+            }
+            code[len++] = (macroinsn){ .op = MACRO_KEY, .key = { action->scan, action->down } };
+        }
+        if (action->scan & SCAN_MOUSE)
+            sync_mouse = 1;
+        else
+            sync_kb = 1;
+        if (action->delay == 0 && action->delay_max == 0)
+            continue;
+
+        code[len++] = (macroinsn){ .op = MACRO_SYNC, .sync = { sync_kb, sync_mouse } };
+        sync_kb = sync_mouse = 0;
+        report_start = len;
+        if (action->delay == UINT32_MAX && macro_coalesce)
+            continue;
+        if (action->delay == UINT32_MAX)
+            code[len++] = (macroinsn){ .op = MACRO_SLEEP, .sleep = { macrodelay.tv_nsec / 1000, 0 } };
+        else
+            code[len++] = (macroinsn){ .op = MACRO_SLEEP, .sleep = { action->delay, action->delay_max } };
+    }
+    if (sync_kb || sync_mouse)
+        code[len++] = (macroinsn){ .op = MACRO_SYNC, .sync = { sync_kb, sync_mouse } };
+    return len;
 }
 
 void initbind(binding* bind, usbdevice* kb){
@@ -591,13 +672,11 @@ void cmd_bind(usbdevice* kb, usbmode* mode, int dummy, int keyindex, const char*
         return;
     }
     // If not numeric, look it up
-    for(int i = 0; i < N_KEYS_INPUT; i++){
-        if(kb->keymap[i].name && !strcmp(to, kb->keymap[i].name)){
-            queued_mutex_lock(imutex(kb));
-            mode->bind.base[keyindex] = kb->keymap[i].scan;
-            queued_mutex_unlock(imutex(kb));
-            return;
-        }
+    int i = findkey(kb, to);
+    if(i >= 0 && i < N_KEYS_INPUT){
+        queued_mutex_lock(imutex(kb));
+        mode->bind.base[keyindex] = kb->keymap[i].scan;
+        queued_mutex_unlock(imutex(kb));
     }
 }
 
@@ -644,12 +723,10 @@ static void _cmd_macro(usbmode* mode, const char* keys, const char* assignment,
     char keyname[40];
     while(position < left && sscanf(keys + position, "%10[^+]%n", keyname, &field) == 1){
         // Find this key in the keymap
-        for(unsigned i = 0; i < N_KEYS_INPUT; i++){
-            if(kb->keymap[i].name && !strcmp(keyname, kb->keymap[i].name)){
-                macro.combo[i / 8] |= 1 << (i % 8);
-                empty = 0;
-                break;
-            }
+        int i = findkey(kb, keyname);
+        if(i >= 0 && i < N_KEYS_INPUT){
+            macro.combo[i / 8] |= 1 << (i % 8);
+            empty = 0;
         }
         if(keys[position += field] == '+')
             position++;
@@ -663,8 +740,8 @@ static void _cmd_macro(usbmode* mode, const char* keys, const char* assignment,
             count++;
     }
     // Allocate a buffer for them
-    macro.actions = calloc(count, sizeof(macroaction));
-    macro.actioncount = 0;
+    macroaction* actions = calloc(count, sizeof(macroaction));
+    int actioncount = 0;
     // Scan the actions
     position = 0;
     field = 0;
@@ -694,20 +771,24 @@ static void _cmd_macro(usbmode* mode, const char* keys, const char* assignment,
         int down = (keyname[0] == '+');
         if(down || keyname[0] == '-'){
             // Find this key in the keymap
-            for(unsigned i = 0; i < N_KEYS_INPUT; i++){
-                if(kb->keymap[i].name && !strcmp(keyname + 1, kb->keymap[i].name)){
-                    macro.actions[macro.actioncount].scan = kb->keymap[i].scan;
-                    macro.actions[macro.actioncount].down = down;
-                    macro.actions[macro.actioncount].delay = delay;
-                    macro.actions[macro.actioncount].delay_max = delay_range;
-                    macro.actioncount++;
-                    break;
-                }
+            int i = findkey(kb, keyname + 1);
+            if(i >= 0 && i < N_KEYS_INPUT){
+                actions[actioncount].scan = kb->keymap[i].scan;
+                actions[actioncount].down = down;
+                actions[actioncount].delay = delay;
+                actions[actioncount].delay_max = delay_range;
+                actioncount++;
             }
         }
         if(assignment[position += field] == ',')
             position++;
     }
+    // Compile them
+    if(actioncount){
+        macro.code = malloc((actioncount * 3 + 1) * sizeof(macroinsn));
+        macro.codelen = macro_compile(actions, actioncount, macro.code);
+    }
+    free(actions);
 
     // See if there's already a macro with this trigger
     keymacro* macros = bind->macros;
@@ -715,7 +796,7 @@ static void _cmd_macro(usbmode* mode, const char* keys, const char* assignment,
         if(!memcmp(macros[i].combo, macro.combo, N_KEYBYTES_INPUT)){
             destroymacro(&macros[i]);
             // If the new macro has no actions, erase the existing one
-            if(!macro.actioncount){
+            if(!macro.codelen){
                 for(int j = i + 1; j < bind->macrocount; j++)
                     memcpy(macros + j - 1, macros + j, sizeof(keymacro));
                 bind->macrocount--;
@@ -727,7 +808,7 @@ static void _cmd_macro(usbmode* mode, const char* keys, const char* assignment,
     }
 
     // Add the macro to the device settings if not empty
-    if(macro.actioncount < 1)
+    if(macro.codelen < 1)
         return;
     memcpy(bind->macros + (bind->macrocount++), &macro, sizeof(keymacro));
     if(bind->macrocount >= bind->macrocap)
@@ -28,6 +28,9 @@ void cmd_unbind(usbdevice* kb, usbmode* mode, int dummy, int keyindex, const cha
 void cmd_rebind(usbdevice* kb, usbmode* mode, int dummy, int keyindex, const char* ignored);
 // Creates or updates a macro. Pass null strings to clear all macros
 void cmd_macro(usbdevice* kb, usbmode* mode, const int notifynumber, const char* keys, const char* assignment);
+// With --macro-coalesce, macro actions using the default delay are sent without sleeping in between.
+// Only affects macros that are bound afterwards.
+extern int macro_coalesce;
 
 #ifdef OS_LINUX
 // Is a key a modifier?
@@ -47,28 +50,30 @@ void os_mousescroll(usbdevice* kb, int x, int y);
 
 // Perform OS-specific setup for indicator lights. Called when the device is created. Return 0 on success.
 int os_setupindicators(usbdevice* kb);
+#ifdef OS_LINUX
+// With --reactor, starts reading indicator light events from the reactor instead of a thread. Called at the end of setup. Return 0 on success.
+int os_reactorindicators(usbdevice* kb);
+#endif
 
 // OS Specific function to either send a report to the input subsystem, or sync the previously sent events
 void os_inputsync(usbdevice* kb, int s_kb, int m);
+// Same as above, but the report is only sent with the next os_inputsync(), so several reports can go out at once
+void os_inputsync_queued(usbdevice* kb, int s_kb, int m);
 
 ///
-/// \brief struct parameter contains the values for a fresh started macro_play thread.
+/// \brief struct parameter contains the values for a macro queued on the device's macro scheduler.
 /// \a parameter_t is the typedef for it.
 ///
 typedef struct _macro_param {
     usbdevice* kb;
     keymacro* macro;
-    macroaction* actions;
-    int actioncount;
+    macroinsn* code;
+    int codelen;
     char abort;
+    struct _macro_param* next;  // Next macro waiting in kb->macroqueue_head
 } macro_param;
 
-/// \brief struct ptlist is one element in the single linked list to store  macro_play threads waiting for their execution
-/// \a ptlist_t is the typedef for it.
-///
-typedef struct ptlist {
-    struct ptlist* next;
-    pthread_t thread_id;
-} ptlist_t;
+// Stops the macro scheduler thread of a device and drops any queued macros. Lock dmutex and imutex first; both are released while waiting
+void macro_stopthread(usbdevice* kb);
 
 #endif  // INPUT_H
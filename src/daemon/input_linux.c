@@ -1,6 +1,7 @@
 #include "command.h"
 #include "device.h"
 #include "input.h"
+#include "reactor.h"
 #include "usb.h"
 
 #ifdef OS_LINUX
@@ -112,6 +113,8 @@ void os_inputclose(usbdevice* kb){
     if(kb->uinput_kb <= 0 || kb->uinput_mouse <= 0)
         return;
 
+    if(use_reactor)
+        reactor_del(&mainreactor, kb->uinput_kb - 1);
     // Tell the led thread to stop and then join it
     if(kb->ledthread){
         kb->shutdown_ledthread = 1;
@@ -152,84 +155,87 @@ void os_inputclose(usbdevice* kb){
     kb->uinput_mouse = 0;
 }
 
-// Generate SYN reports to synchronize device
-static void isync(int fd){
-    struct input_event event;
-    memset(&event, 0, sizeof(event));
-    event.type = EV_SYN;
-    event.code = SYN_REPORT;
-    if(write(fd, &event, sizeof(event)) <= 0)
+// Events are queued until the next os_inputsync() and then written to each uinput device with a single write().
+// Both the input thread and the macro threads generate events for the same device, so the queues are per thread.
+#define UINPUT_QUEUE_MAX 64
+typedef struct {
+    struct input_event events[UINPUT_QUEUE_MAX];
+    int count;
+    int fd;
+} uinput_queue;
+static __thread uinput_queue uqueue[2]; // Keyboard, mouse
+
+static void uinput_flush(uinput_queue* queue){
+    if(!queue->count)
+        return;
+    ssize_t size = sizeof(struct input_event) * queue->count;
+    if(write(queue->fd, queue->events, size) != size)
         ckb_warn("uinput write failed: %s", strerror(errno));
+    queue->count = 0;
+}
+
+static void uinput_event(int fd, int is_mouse, ushort type, ushort code, int value){
+    uinput_queue* queue = uqueue + !!is_mouse;
+    // Keep the order of events if the queue is full or switches devices
+    if(queue->count && (queue->fd != fd || queue->count == UINPUT_QUEUE_MAX))
+        uinput_flush(queue);
+    queue->fd = fd;
+    struct input_event* event = queue->events + queue->count++;
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->code = code;
+    event->value = value;
 }
 
 void os_keypress(usbdevice* kb, int scancode, int down){
-    struct input_event event;
-    memset(&event, 0, sizeof(event));
     // Mouse buttons and key events are both EV_KEY. The scancodes are already correct, just remove the ckb bit
-    event.type = EV_KEY;
-    event.code = scancode & ~SCAN_MOUSE;
-    event.value = down;
     int is_mouse = scancode & SCAN_MOUSE;
     int fd = (is_mouse ? kb->uinput_mouse : kb->uinput_kb) - 1;
-    if(write(fd, &event, sizeof(event)) <= 0)
-        ckb_warn("uinput write failed: %s", strerror(errno));
+    uinput_event(fd, is_mouse, EV_KEY, scancode & ~SCAN_MOUSE, down);
 }
 
 void os_mousemove(usbdevice* kb, int x, int y){
-    struct input_event event;
-    memset(&event, 0, sizeof(event));
-    event.type = EV_REL;
     int fd = kb->uinput_mouse - 1;
     //send X
-    if(x){
-        event.code = REL_X;
-        event.value = x;
-        if(write(fd, &event, sizeof(event)) <= 0)
-            ckb_warn("uinput write failed: %s", strerror(errno));
-    }
+    if(x)
+        uinput_event(fd, 1, EV_REL, REL_X, x);
     //send Y
-    if(y){
-        event.code = REL_Y;
-        event.value = y;
-        if(write(fd, &event, sizeof(event)) <= 0)
-            ckb_warn("uinput write failed: %s", strerror(errno));
-    }
+    if(y)
+        uinput_event(fd, 1, EV_REL, REL_Y, y);
 }
 
-void os_inputsync(usbdevice* kb, int s_kb, int m){
+// Generate SYN reports to synchronize the devices
+void os_inputsync_queued(usbdevice* kb, int s_kb, int m){
     if(s_kb){
-        isync(kb->uinput_kb - 1);
+        uinput_event(kb->uinput_kb - 1, 0, EV_SYN, SYN_REPORT, 0);
 #ifdef DEBUG_INPUT_SYNC
         ckb_info("Uinput keyboard sync");
 #endif
     }
 
     if(m){
-        isync(kb->uinput_mouse - 1);
+        uinput_event(kb->uinput_mouse - 1, 1, EV_SYN, SYN_REPORT, 0);
 #ifdef DEBUG_INPUT_SYNC
         ckb_info("Uinput mouse sync");
 #endif
     }
 }
 
+// Same as above, and send everything that was queued
+void os_inputsync(usbdevice* kb, int s_kb, int m){
+    os_inputsync_queued(kb, s_kb, m);
+    uinput_flush(uqueue);
+    uinput_flush(uqueue + 1);
+}
+
 void os_mousescroll(usbdevice* kb, int x, int y){
-    struct input_event event = {0};
-    event.type = EV_REL;
     int fd = kb->uinput_mouse - 1;
 
-    if(x){
-        event.code = REL_HWHEEL;
-        event.value = x;
-        if(write(fd, &event, sizeof(event)) <= 0)
-            ckb_warn("uinput write failed: %s", strerror(errno));
-    }
+    if(x)
+        uinput_event(fd, 1, EV_REL, REL_HWHEEL, x);
 
-    if(y){
-        event.code = REL_WHEEL;
-        event.value = y;
-        if(write(fd, &event, sizeof(event)) <= 0)
-            ckb_warn("uinput write failed: %s", strerror(errno));
-    }
+    if(y)
+        uinput_event(fd, 1, EV_REL, REL_WHEEL, y);
 }
 
 void* _ledthread(void* ctx){
@@ -270,9 +276,47 @@ void* _ledthread(void* ctx){
     return 0;
 }
 
+// Same as one iteration of _ledthread(), called by the reactor when there are LED events
+static void ledevent(void* context){
+    usbdevice* kb = context;
+    wait_until_suspend_processed();
+    queued_mutex_lock(dmutex(kb));
+    // The device may have been closed while the event was queued
+    if(kb->status != DEV_STATUS_CONNECTED || kb->uinput_kb <= 0){
+        queued_mutex_unlock(dmutex(kb));
+        return;
+    }
+    uchar ileds = kb->hw_ileds;
+    struct input_event event;
+    while(read(kb->uinput_kb - 1, &event, sizeof(event)) > 0){
+        if(event.type == EV_LED && event.code < 8){
+            char which = 1 << event.code;
+            if(event.value)
+                ileds |= which;
+            else
+                ileds &= ~which;
+        }
+    }
+    if(kb->hw_ileds != ileds){
+        kb->hw_ileds = ileds;
+        kb->vtable.updateindicators(kb, 0);
+    }
+    queued_mutex_unlock(dmutex(kb));
+}
+
+int os_reactorindicators(usbdevice* kb){
+    // The fd is also written to, but uinput writes never block anyway
+    const int fd = kb->uinput_kb - 1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return reactor_add(&mainreactor, fd, EPOLLIN, ledevent, kb);
+}
+
 int os_setupindicators(usbdevice* kb){
     // Initialize LEDs to all off
     kb->hw_ileds = kb->hw_ileds_old = kb->ileds = 0;
+    // The reactor takes over once setup is finished, see os_reactorindicators()
+    if(use_reactor)
+        return 0;
     // Create and detach thread to read LED events
     kb->ledthread = malloc(sizeof(pthread_t));
     if(!kb->ledthread){
@@ -6,6 +6,7 @@
 #include "bragi_proto.h"
 #include "nxp_proto.h"
 #include "bragi_notification.h"
+#include "trace.h"
 
 // Translates input from HID to a ckb input bitfield.
 static void hid_kb_translate(unsigned char* kbinput, int length, const unsigned char* urbinput, int legacy);
@@ -594,6 +595,8 @@ void process_input_urb(void* context, unsigned char* buffer, int urblen, ushort
         return;
 
     usbdevice* kb = context;
+    STATS_ADD(kb, input_urbs, 1);
+    TRACE3(input_urb, INDEX_OF(kb, keyboard), ep, urblen);
 
 #ifdef DEBUG_USB_INPUT
     print_urb_buffer("Input:", buffer, urblen, NULL, 0, NULL, INDEX_OF(kb, keyboard), (uchar)ep);
@@ -643,18 +646,8 @@ void process_input_urb(void* context, unsigned char* buffer, int urblen, ushort
 #ifdef DEBUG_USB_RECV
     print_urb_buffer("Recv:", buffer, urblen, NULL, 0, NULL, INDEX_OF(targetkb, keyboard), (uchar)ep);
 #endif
-        int retval = pthread_mutex_lock(intmutex(targetkb));
-        if(retval)
-            ckb_fatal("Error locking interrupt mutex %i", retval);
-        memcpy(targetkb->interruptbuf, buffer, kb->out_ep_packet_size);
-
-        // signal os_usbrecv() that the data is ready.
-        retval = pthread_cond_broadcast(intcond(targetkb));
-        if(retval)
-            ckb_fatal("Error broadcasting pthread cond %i", retval);
-        retval = pthread_mutex_unlock(intmutex(targetkb));
-        if(retval)
-            ckb_fatal("Error unlocking interrupt mutex %i", retval);
+        // Queue it for os_usbrecv(), which is woken up if it's waiting
+        intring_push(targetkb, buffer, kb->out_ep_packet_size);
     } else if (kb->protocol == PROTO_BRAGI && urblen == kb->out_ep_packet_size && buffer[1] == BRAGI_INPUT_NOTIFY){
         // Process bragi notifications
         bragi_process_notification(kb, targetkb, buffer);
@@ -56,6 +56,8 @@
 // Total number of keys recognized by software
 #define N_KEYS_EXTENDED         (N_KEYS_INPUT + N_MOUSE_ZONES_EXTENDED)
 #define N_KEYBYTES_EXTENDED     ((N_KEYS_EXTENDED + 7) / 8)
+// Size of the per-device key name lookup table. Must be a power of two, and at least twice N_KEYS_EXTENDED
+#define KEY_HASH_SIZE           512
 
 #define N_KEYS_BRAGI_PATCH      171
 
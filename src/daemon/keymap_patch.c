@@ -91,6 +91,43 @@ keypatches mappatches[] = {
 };
 #define KEYPATCHES_LEN sizeof(mappatches)/sizeof(*mappatches)
 
+_Static_assert((KEY_HASH_SIZE & (KEY_HASH_SIZE - 1)) == 0 && KEY_HASH_SIZE >= N_KEYS_EXTENDED * 2, "KEY_HASH_SIZE must be a power of two and at least twice N_KEYS_EXTENDED");
+
+// FNV-1a
+static inline uint32_t keyhash(const char* name){
+    uint32_t hash = 2166136261u;
+    while(*name){
+        hash ^= (uchar)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int findkey(const usbdevice* kb, const char* name){
+    for(uint32_t slot = keyhash(name) & (KEY_HASH_SIZE - 1); kb->keyhash[slot]; slot = (slot + 1) & (KEY_HASH_SIZE - 1)){
+        int idx = kb->keyhash[slot] - 1;
+        if(!strcmp(name, kb->keymap[idx].name))
+            return idx;
+    }
+    return -1;
+}
+
+/// \brief
+///
+/// Rebuild the key name lookup table from the patched keymap.
+/// Only the first key with a given name is inserted, which matches what a linear search would return.
+static void buildkeyhash(usbdevice* kb){
+    memset(kb->keyhash, 0, sizeof(kb->keyhash));
+    for(int i = 0; i < N_KEYS_EXTENDED; i++){
+        if(!kb->keymap[i].name || findkey(kb, kb->keymap[i].name) >= 0)
+            continue;
+        uint32_t slot = keyhash(kb->keymap[i].name) & (KEY_HASH_SIZE - 1);
+        while(kb->keyhash[slot])
+            slot = (slot + 1) & (KEY_HASH_SIZE - 1);
+        kb->keyhash[slot] = i + 1;
+    }
+}
+
 /// \brief
 ///
 /// Copy the keymap to the usbdevice struct, and iterate through the keypatches array.
@@ -142,7 +179,9 @@ void patchkeys(usbdevice* kb){
                 kb->keymap[idx].led = curpatch[i].led;
                 kb->keymap[idx].scan = curpatch[i].scan;
             }
-            return;
+            break;
         }
     }
+
+    buildkeyhash(kb);
 }
@@ -18,3 +18,8 @@ typedef struct {
 /// \brief patchkeys Used to patch the keymaps when necessary
 /// \param kb THE usbdevice*
 void patchkeys(usbdevice* kb);
+
+///
+/// \brief findkey Look up a key by name in the device's patched keymap
+/// \return the keymap index of the first key with that name, or -1 if there is none
+int findkey(const usbdevice* kb, const char* name);
@@ -3,6 +3,7 @@
 #include "profile.h"
 #include "usb.h"
 #include "dpi.h"
+#include <sched.h>
 
 void cmd_rgb(usbdevice* kb, usbmode* mode, int dummy, int keyindex, const char* code){
     (void)kb;
@@ -49,6 +50,52 @@ void cmd_rgb(usbdevice* kb, usbmode* mode, int dummy, int keyindex, const char*
     }
 }
 
+int applyframe(usbdevice* kb, usbmode* mode){
+    const ckb_frame* frame = kb->frame;
+    if(!frame)
+        return -1;
+    // The client may already be writing the next frame. Give it a moment and retry if the sequence changed under us.
+    for(int tries = 0; tries < 3; tries++){
+        if(tries)
+            sched_yield();
+        uint32_t seq = __atomic_load_n(&frame->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+            continue;
+        if(seq == kb->frame_seq)
+            return 0;
+        uchar r[N_KEYS_EXTENDED], g[N_KEYS_EXTENDED], b[N_KEYS_EXTENDED];
+        memcpy(r, frame->r, sizeof(r));
+        memcpy(g, frame->g, sizeof(g));
+        memcpy(b, frame->b, sizeof(b));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&frame->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+        kb->frame_seq = seq;
+        for(int i = 0; i < N_KEYS_EXTENDED; i++){
+            if(!kb->keymap[i].name)
+                continue;
+            short index = kb->keymap[i].led;
+            if(index == -2){
+                // Strafe sidelights are monochromatic, same as cmd_rgb
+                mode->light.sidelight = r[i];
+                continue;
+            }
+            if(index < 0)
+                continue;
+            mode->light.r[index] = r[i];
+            mode->light.g[index] = g[i];
+            mode->light.b[index] = b[i];
+        }
+        return 0;
+    }
+    // The next commit picks the frame up, so this is routine at high frame rates. Only mention it once, the rest are
+    // counted in the stats node.
+    STATS_ADD(kb, frames_skipped, 1);
+    if(kb->stats.frames_skipped == 1)
+        ckb_info("ckb%d: Frame is being written too fast, skipping (further skips are counted in the stats node)", INDEX_OF(kb, keyboard));
+    return -1;
+}
+
 // Indicator bitfield from string
 static uchar iselect(const char* led){
     int result = 0;
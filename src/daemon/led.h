@@ -30,6 +30,8 @@ char* printrgb(const lighting* light, const usbdevice* kb);
 // Command: Update an LED color
 void cmd_rgb(usbdevice* kb, usbmode* mode, int dummy, int keyindex, const char* code);
 void cmd_hwanim(usbdevice* kb, usbmode* mode, int dummy, int dummy2, const char* dummy3);
+// Copies the most recently committed frame from the frame node into a mode's lighting. Returns 0 on success.
+int applyframe(usbdevice* kb, usbmode* mode);
 
 // Command: Turn an indicator off permanently
 void cmd_ioff(usbdevice* kb, usbmode* mode, int dummy1, int dummy2, const char* led);
@@ -72,6 +72,8 @@ static int updatergb_bragi(usbdevice* kb, int force, const size_t led_offset){
 
     static_assert(sizeof(pkt) >= 7 + N_KEYS_EXTENDED * 3, "Bragi RGB packet must be large enough to fit all possible zones in the keymap");
 
+    // The lighting handle only accepts a complete write starting at offset 0 (WRITE_DATA followed by CONTINUE_WRITE),
+    // so a frame is always sent in full.
     size_t bytes = zones;
 
     memcpy(pkt + 7, newlight->r + led_offset, CPY_SZ(r));
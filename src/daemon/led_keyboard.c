@@ -166,7 +166,7 @@ int updatergb_kb(usbdevice* kb, int force){
         if(IS_MONOCHROME_DEV(kb))
             data_pkt_count = 4;
 
-        if(!usbsend(kb, data_pkt[0], MSG_SIZE, data_pkt_count))
+        if(!usbsend_batch(kb, data_pkt[0], MSG_SIZE, data_pkt_count))
             return -1;
     } else {
         // Update strafe sidelights if necessary
@@ -181,7 +181,7 @@ int updatergb_kb(usbdevice* kb, int force){
             { CMD_SET, FIELD_KB_9BCLR, 0x00, 0x00, 0xD8 }
         };
         makergb_512(newlight, data_pkt, kb->dither ? ordered8to3 : quantize8to3);
-        if(!usbsend(kb, data_pkt[0], MSG_SIZE, 5))
+        if(!usbsend_batch(kb, data_pkt[0], MSG_SIZE, 5))
             return -1;
     }
 
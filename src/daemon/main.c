@@ -3,7 +3,9 @@
 #include "input.h"
 #include "led.h"
 #include "notify.h"
+#include "reactor.h"
 #include "request_hid_mac.h"
+#include "usb_sim.h"
 #include <ckbnextconfig.h>
 #include <stdlib.h>
 #include <time.h>
@@ -169,7 +171,22 @@ int main(int argc, char** argv){
 #endif
                         "    --nonroot\n"
                         "        Allows running ckb-next-daemon as a non root user.\n"
-                        "        This will almost certainly not work. Use only if you know what you're doing.\n",
+                        "        This will almost certainly not work. Use only if you know what you're doing.\n"
+                        "    --macro-coalesce\n"
+                        "        Sends macro actions without an explicit delay back to back instead of 1ms apart.\n"
+                        "        Much faster for long text macros, but some applications drop keys that arrive this fast.\n"
+#ifdef OS_LINUX
+                        "    --simulate=<vid>:<pid>[:<count>[:<script>]]\n"
+                        "        Adds <count> simulated devices that are answered in-process, for testing without hardware.\n"
+                        "        <script> lists input reports to replay in a loop as \"<delay in ms> <endpoint> <bytes...>\" (hex).\n"
+                        "    --reactor\n"
+                        "        Handles the commands and indicator lights of all devices on one thread instead of two per device.\n"
+                        "        Uses fewer threads, but a slow command (such as a firmware update) holds up the other devices.\n"
+                        "    --input-reactor[=<cpu>[:<priority>]]\n"
+                        "        Reaps the input of all devices on one thread instead of one per device.\n"
+                        "        The thread is pinned to <cpu> if given, and runs as SCHED_FIFO with <priority> if given.\n"
+#endif
+                        ,
                         CKB_NEXT_DESCRIPTION, devpath);
             return 0;
         } else if (!strcmp(argv[i], "--version")){
@@ -237,7 +254,8 @@ int main(int argc, char** argv){
 
             patchkeys(&dev);
 
-            // Search through the patched keymap
+            // Search through the patched keymap. This stays a linear scan instead of findkey(), since the search is
+            // case-insensitive, can look for the first unnamed slot, and only runs once
             for (int j = 0; j < N_KEYS_EXTENDED; j++) {
                 // Special case, where we're searching for the first NULL entry
                 if (!dev.keymap[j].name) {
@@ -255,6 +273,36 @@ int main(int argc, char** argv){
             }
             printf("Key %s was not found\n", searchstr);
             return 1;
+        } else if(!strncmp(argument, "--simulate=", 11)) {
+#ifdef OS_LINUX
+            if(sim_request(argument + 11)){
+                ckb_fatal_nofile("Invalid device in %s. Expected --simulate=<vid>:<pid>[:<count>[:<script>]]", argument);
+                return 1;
+            }
+#else
+            ckb_warn_nofile("Simulated devices are only supported on Linux");
+#endif
+        } else if(!strcmp(argument, "--macro-coalesce")) {
+            macro_coalesce = 1;
+            ckb_info_nofile("Macro actions without a delay are sent back to back");
+        } else if(!strcmp(argument, "--reactor")) {
+#ifdef OS_LINUX
+            use_reactor = 1;
+            ckb_info_nofile("Device commands and indicators are handled by the reactor");
+#else
+            ckb_warn_nofile("--reactor is only supported on Linux");
+#endif
+        } else if(!strncmp(argument, "--input-reactor", 15) && (argument[15] == '\0' || argument[15] == '=')) {
+#ifdef OS_LINUX
+            use_inputreactor = 1;
+            if(argument[15] == '=' && sscanf(argument + 16, "%d:%d", &inputreactor_cpu, &inputreactor_priority) < 1){
+                ckb_fatal_nofile("Invalid CPU in %s. Expected --input-reactor[=<cpu>[:<priority>]]", argument);
+                return 1;
+            }
+            ckb_info_nofile("Input is reaped by the input reactor");
+#else
+            ckb_warn_nofile("--input-reactor is only supported on Linux");
+#endif
         } else if(!strcmp(argument, "--enable-experimental")) {
             enable_experimental = 1;
 #ifdef ckb_next_VERSION_IS_RELEASE
@@ -5,42 +5,94 @@
 #include "notify.h"
 #include "profile.h"
 #include "command.h"
+#include <poll.h>
+
+// Returns the subset of nodes that are open
+static unsigned nodes_open(usbdevice* kb, unsigned nodes){
+    unsigned open = 0;
+    for(int i = 0; i < OUTFIFO_MAX; i++){
+        if((nodes & (1U << i)) && kb->outfifo[i])
+            open |= 1U << i;
+    }
+    return open;
+}
+
+// Writes a complete line to each of the nodes.
+// The nodes are opened with O_NONBLOCK, so a reader that isn't keeping up never stalls the input thread.
+// A line of up to PIPE_BUF bytes is written in full or not at all. Lines that don't fit are dropped and counted in the stats node.
+// Longer lines (only command replies such as "rgb") wait briefly for the reader once started, rather than being cut off.
+static void nwrite(usbdevice* kb, unsigned nodes, const char* line, size_t len){
+    for(int i = 0; i < OUTFIFO_MAX; i++){
+        int fifo = kb->outfifo[i] - 1;
+        if(!(nodes & (1U << i)) || fifo == -1)
+            continue;
+        size_t written = 0;
+        while(written < len){
+            ssize_t res = write(fifo, line + written, len - written);
+            if(res > 0){
+                written += res;
+                continue;
+            }
+            if(res < 0 && errno == EINTR)
+                continue;
+            if(res < 0 && errno == EAGAIN && written){
+                struct pollfd pfd = { .fd = fifo, .events = POLLOUT };
+                if(poll(&pfd, 1, 100) > 0)
+                    continue;
+            }
+            break;
+        }
+        if(written < len)
+            STATS_ADD(kb, notify_dropped, 1);
+    }
+}
 
 void nprintf(usbdevice* kb, int nodenumber, usbmode* mode, const char* format, ...){
     if(!kb)
         return;
-    usbprofile* profile = kb->profile;
+    unsigned nodes = nodes_open(kb, nodenumber >= 0 ? 1U << nodenumber : ~0U);
+    if(!nodes)
+        return;
+    // Format the line once for all of the nodes
+    char buffer[256];
+    int prefix = 0;
+    if(mode)
+        prefix = snprintf(buffer, sizeof(buffer), "mode %d ", INDEX_OF(mode, kb->profile->mode) + 1);
     va_list va_args;
-    int fifo;
-    if(nodenumber >= 0){
-        // If node number was given, print to that node (if open)
-        if((fifo = kb->outfifo[nodenumber] - 1) != -1){
-            va_start(va_args, format);
-                if(mode)
-                    dprintf(fifo, "mode %d ", INDEX_OF(mode, profile->mode) + 1);
-                vdprintf(fifo, format, va_args);
-            va_end(va_args);
-        }
+    va_start(va_args, format);
+    int len = vsnprintf(buffer + prefix, sizeof(buffer) - prefix, format, va_args);
+    va_end(va_args);
+    if(len < 0)
+        return;
+    if((size_t)(prefix + len) < sizeof(buffer)){
+        nwrite(kb, nodes, buffer, prefix + len);
         return;
     }
-    // Otherwise, print to all nodes
-    for(int i = 0; i < OUTFIFO_MAX; i++){
-        if((fifo = kb->outfifo[i] - 1) != -1){
-            va_start(va_args, format);
-                if(mode)
-                    dprintf(fifo, "mode %d ", INDEX_OF(mode, profile->mode) + 1);
-                vdprintf(fifo, format, va_args);
-            va_end(va_args);
-        }
-    }
+    // Didn't fit, try again with a buffer of the right size
+    char* line = malloc(prefix + len + 1);
+    if(!line)
+        return;
+    memcpy(line, buffer, prefix);
+    va_start(va_args, format);
+    vsnprintf(line + prefix, len + 1, format, va_args);
+    va_end(va_args);
+    nwrite(kb, nodes, line, prefix + len);
+    free(line);
 }
 
-void nprintkey(usbdevice* kb, int nnumber, int keyindex, int down){
+void nprintkey(usbdevice* kb, unsigned nodes, int keyindex, int down){
+    nodes = nodes_open(kb, nodes);
+    if(!nodes)
+        return;
     const key* map = kb->keymap + keyindex;
+    char line[64];
+    int len;
     if(map->name)
-        nprintf(kb, nnumber, 0, "key %c%s\n", down ? '+' : '-', map->name);
+        len = snprintf(line, sizeof(line), "key %c%s\n", down ? '+' : '-', map->name);
     else
-        nprintf(kb, nnumber, 0, "key %c#%d\n", down ? '+' : '-', keyindex);
+        len = snprintf(line, sizeof(line), "key %c#%d\n", down ? '+' : '-', keyindex);
+    if(len > 0 && (size_t)len < sizeof(line))
+        nwrite(kb, nodes, line, len);
 }
 
 void nprintind(usbdevice* kb, int nnumber, int led, int on){
@@ -176,7 +228,7 @@ static void _cmd_get(usbdevice* kb, usbmode* mode, int nnumber, const char* sett
             int byte = i / 8, bit = 1 << (i & 7);
             uchar state = kb->input.keys[byte] & bit;
             if(state)
-                nprintkey(kb, nnumber, i, 1);
+                nprintkey(kb, 1U << nnumber, i, 1);
         }
     } else if(!strcmp(setting, ":i")){
         // Get the current state of all indicator LEDs
@@ -11,8 +11,8 @@
 // Specify a USB mode to print "mode <n>" before the notification. A null mode will not print a number
 void nprintf(usbdevice* kb, int nodenumber, usbmode* mode, const char* format, ...);
 
-// Prints a key's current state to a notification node
-void nprintkey(usbdevice* kb, int nnumber, int keyindex, int down);
+// Prints a key's current state to every notification node in the nodes bitmask (bit n for node n)
+void nprintkey(usbdevice* kb, unsigned nodes, int keyindex, int down);
 // Prints the current indicator state to a notification node (led should be an I_ constant)
 // MUTEXES: Lock imutex before calling
 void nprintind(usbdevice* kb, int nnumber, int led, int on);
@@ -28,8 +28,10 @@
 
 #include <features.h>
 #include <libudev.h>
+#include <linux/futex.h>
 #include <linux/uinput.h>
 #include <linux/usbdevice_fs.h>
+#include <sys/syscall.h>
 
 #ifndef UINPUT_VERSION
 #define UINPUT_VERSION 2
@@ -0,0 +1,121 @@
+#include "device.h"
+#include "reactor.h"
+
+#ifdef OS_LINUX
+#include <sched.h>
+
+#define REACTOR_EVENTS  16
+
+reactor mainreactor = REACTOR_INITIALIZER, inputreactor = REACTOR_INITIALIZER;
+
+int use_reactor = 0;
+int use_inputreactor = 0, inputreactor_cpu = -1, inputreactor_priority = 0;
+
+int reactor_init(reactor* r){
+    r->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if(r->epollfd == -1){
+        ckb_fatal("epoll_create1() failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void* reactor_main(void* context){
+    reactor* r = context;
+    while(1)
+        reactor_run(r);
+    return 0;
+}
+
+int reactor_start(reactor* r, const char* name, int cpu, int priority){
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, reactor_main, r);
+    pthread_attr_destroy(&attr);
+    if(err){
+        ckb_err("Failed to create the %s thread: %s", name, strerror(err));
+        return -1;
+    }
+    pthread_setname_np(thread, name);
+
+    if(cpu >= 0){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if((err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus)))
+            ckb_warn("Unable to pin %s to CPU %d: %s", name, cpu, strerror(err));
+    }
+    if(priority > 0){
+        struct sched_param param = { .sched_priority = priority };
+        if((err = pthread_setschedparam(thread, SCHED_FIFO, &param)))
+            ckb_warn("Unable to set SCHED_FIFO priority %d for %s: %s", priority, name, strerror(err));
+    }
+    return 0;
+}
+
+int reactor_add(reactor* r, int fd, uint32_t events, reactor_cb cb, void* context){
+    pthread_mutex_lock(&r->slotmutex);
+    int i;
+    for(i = 0; i < REACTOR_MAX; i++)
+        if(!r->slots[i].fd)
+            break;
+    if(i == REACTOR_MAX){
+        pthread_mutex_unlock(&r->slotmutex);
+        ckb_err("Too many fds in the reactor");
+        return -1;
+    }
+    reactor_slot* slot = r->slots + i;
+    slot->cb = cb;
+    slot->context = context;
+    slot->fd = fd + 1;
+    slot->generation++;
+    struct epoll_event event = {
+        .events = events,
+        .data.u64 = (uint64_t)slot->generation << 32 | i,
+    };
+    if(epoll_ctl(r->epollfd, EPOLL_CTL_ADD, fd, &event)){
+        ckb_err("Unable to add fd %d to the reactor: %s", fd, strerror(errno));
+        slot->fd = 0;
+        pthread_mutex_unlock(&r->slotmutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&r->slotmutex);
+    return 0;
+}
+
+void reactor_del(reactor* r, int fd){
+    pthread_mutex_lock(&r->slotmutex);
+    for(int i = 0; i < REACTOR_MAX; i++){
+        if(r->slots[i].fd != fd + 1)
+            continue;
+        epoll_ctl(r->epollfd, EPOLL_CTL_DEL, fd, NULL);
+        r->slots[i].fd = 0;
+        break;
+    }
+    pthread_mutex_unlock(&r->slotmutex);
+}
+
+void reactor_run(reactor* r){
+    struct epoll_event events[REACTOR_EVENTS];
+    int count = epoll_wait(r->epollfd, events, REACTOR_EVENTS, -1);
+    if(count == -1){
+        if(errno != EINTR)
+            ckb_err("epoll_wait() failed: %s", strerror(errno));
+        return;
+    }
+    for(int i = 0; i < count; i++){
+        const uint32_t index = events[i].data.u64 & 0xffffffff;
+        const uint32_t generation = events[i].data.u64 >> 32;
+        // An earlier callback in this batch (or another thread) may have removed the fd
+        pthread_mutex_lock(&r->slotmutex);
+        reactor_slot slot = r->slots[index];
+        pthread_mutex_unlock(&r->slotmutex);
+        if(!slot.fd || slot.generation != generation)
+            continue;
+        slot.cb(slot.context);
+    }
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "includes.h"
+#include "device.h"
+#ifdef OS_LINUX
+#include <sys/epoll.h>
+#endif
+
+// epoll event loops (Linux only).
+// mainreactor is run by usbmain() on the main thread. It always handles the udev monitor and the signal pipe.
+// With --reactor it also reads every device's cmd node and indicator LED events, instead of one devmain() thread and
+// one _ledthread() per device.
+// inputreactor runs on its own thread with --input-reactor, and reaps the input URBs of every device instead of one
+// os_inputmain() thread per device.
+//
+// Callbacks run on the reactor's thread, one at a time, so they must not block for long. Devices register their fds
+// once setup is finished, so that the reactor never waits for a dmutex held during setup.
+// fds are level-triggered. A callback may run once more after its fd was removed from another thread, so device
+// callbacks have to check that the device is still connected after locking its dmutex.
+
+typedef void (*reactor_cb)(void* context);
+
+// Two fds per device, plus a few of the reactor's own
+#define REACTOR_MAX     (DEV_MAX * 2 + 2)
+
+typedef struct {
+    reactor_cb cb;
+    void* context;
+    // fd + 1, 0 when the slot is unused (see usbdevice in structures.h)
+    int fd;
+    // Incremented every time the slot is reused, so that events queued for the previous fd are ignored
+    uint32_t generation;
+} reactor_slot;
+
+typedef struct {
+    int epollfd;
+    reactor_slot slots[REACTOR_MAX];
+    pthread_mutex_t slotmutex;
+} reactor;
+
+#define REACTOR_INITIALIZER { -1, {{0}}, PTHREAD_MUTEX_INITIALIZER }
+
+extern reactor mainreactor, inputreactor;
+
+// Set by --reactor
+extern int use_reactor;
+// Set by --input-reactor. The CPU to pin the input reactor to (-1 for none), and its SCHED_FIFO priority (0 for none)
+extern int use_inputreactor, inputreactor_cpu, inputreactor_priority;
+
+/// \brief reactor_init creates the event loop. Returns 0 on success.
+int reactor_init(reactor* r);
+
+/// \brief reactor_start runs the event loop on a new thread, optionally pinned to cpu and with SCHED_FIFO priority. Returns 0 on success.
+/// Failing to set the affinity or the priority is only a warning.
+int reactor_start(reactor* r, const char* name, int cpu, int priority);
+
+/// \brief reactor_add calls cb(context) from the reactor thread whenever fd has one of the epoll events. Returns 0 on success.
+int reactor_add(reactor* r, int fd, uint32_t events, reactor_cb cb, void* context);
+
+/// \brief reactor_del stops watching fd. Must be called before it is closed. Does nothing if fd isn't watched.
+void reactor_del(reactor* r, int fd);
+
+/// \brief reactor_run waits for events and dispatches them, returning after each batch.
+void reactor_run(reactor* r);
+
+#endif  // REACTOR_H
@@ -37,12 +37,31 @@ typedef struct {
     uint32_t delay_max; // us delay. If != 0 then a delay is randomly picked from delay to delay_max
 } macroaction;
 
+// Compiled macro instruction (see macro_compile() in input.c)
+typedef enum {
+    MACRO_KEY,      // Key or mouse button event
+    MACRO_SCROLL,   // Wheel movement
+    MACRO_MOVE,     // Mouse movement
+    MACRO_SYNC,     // End of an input report. Reports are only written out on the next MACRO_SLEEP or at the end
+    MACRO_SLEEP,    // Write out all reports, then wait
+} macroop;
+
+typedef struct {
+    uchar op;
+    union {
+        struct { short scan; char down; } key;
+        struct { short x, y; } rel;                 // MACRO_SCROLL, MACRO_MOVE
+        struct { char kb, mouse; } sync;
+        struct { uint32_t delay, delay_max; } sleep; // us; if delay_max != 0 then a delay is randomly picked from delay to delay_max
+    };
+} macroinsn;
+
 struct _macro_param;
 
 // Key macro
 typedef struct {
-    macroaction* actions;
-    int actioncount;
+    macroinsn* code;
+    int codelen;
     uchar combo[N_KEYBYTES_INPUT];
 
     /*
@@ -52,8 +71,8 @@ typedef struct {
      *  - The counter is decremented by two, unless it is at 1.
      *  - If state > 0, the macro is repeated, with a delay if state == 1.
      *
-     * If the key is released during the delay, the counter is set to 0, and the running
-     * thread shuts itself down immediately.
+     * If the key is released during the delay, the counter is set to 0, and the macro
+     * scheduler stops playing it immediately.
      */
     char triggered;
     struct _macro_param* param;
@@ -231,6 +250,44 @@ typedef enum pollrate_ {
 } pollrate_t;
 
 
+// Shared lighting frame, mapped from the frame node (see devnode.h)
+// Clients fill in r/g/b for the keys they know by name, then send "frame commit" through the cmd node.
+// seq is odd while a client is writing and is incremented again once the frame is complete.
+#define FRAME_MAGIC     0x314d5246  // "FRM1"
+#define FRAME_NAME_LEN  12
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t seq;
+    uint32_t reserved;
+    char name[N_KEYS_EXTENDED][FRAME_NAME_LEN];
+    uchar r[N_KEYS_EXTENDED];
+    uchar g[N_KEYS_EXTENDED];
+    uchar b[N_KEYS_EXTENDED];
+} ckb_frame;
+
+// Runtime statistics, written to the stats node (see devnode.h)
+// Bucket i of the latency histogram counts transfers that took less than 2^i microseconds (the last one has no limit)
+#define STATS_LATENCY_BUCKETS   24
+typedef struct {
+    // Frames applied, either as an rgb command or a frame node commit
+    uint64_t rgb_cmds;
+    // Buffered rgb frames that were skipped because a newer frame for the same mode followed them
+    uint64_t rgb_dropped;
+    // Frame node commits that were skipped because the client kept rewriting the frame while it was being read
+    uint64_t frames_skipped;
+    // Output transfers that were sent and the bytes they carried, transfers that had to be retried, and device resets
+    uint64_t usb_writes, usb_bytes, usb_retries, usb_resets;
+    // Input URBs received from the device, and notification lines dropped because a reader wasn't keeping up
+    uint64_t input_urbs, notify_dropped;
+    // Time from submitting each output transfer until it completed, not counting the delay before it
+    uint32_t send_latency[STATS_LATENCY_BUCKETS];
+    // Set when anything changed since the stats node was last written
+    char dirty;
+} devstats;
+// Counters are updated from the device, input and indicator threads, so they're only ever added to atomically
+#define STATS_ADD(kb, field, n) do { __atomic_add_fetch(&(kb)->stats.field, (n), __ATOMIC_RELAXED); (kb)->stats.dirty = 1; } while(0)
+
 // Structure for tracking keyboard/mouse devices
 #define KB_NAME_LEN         64
 #define SERIAL_LEN          35
@@ -242,6 +299,25 @@ typedef enum pollrate_ {
 #define MAX_CHILDREN        8
 #define PAIR_ID_SIZE        8
 
+// Responses handed from the input thread to usbrecv(). Single producer, single consumer; see intring_push() in device.h
+#define INTRING_SIZE        8
+typedef struct {
+    uchar pkt[INTRING_SIZE][MAX_MSG_SIZE];
+    uint32_t head;      // Only written by the consumer
+    uint32_t tail;      // Only written by the producer. Also used as the futex word on Linux
+    uint32_t waiting;   // Set while the consumer is (about to be) asleep
+} intring;
+
+// USB delay calibration state. Scales are a percentage of the built-in delay for each delay_type_t
+typedef struct {
+    ushort scale[DELAY_TYPE_COUNT];
+    uint streak[DELAY_TYPE_COUNT];          // Consecutive good transfers at the current scale
+    uint64_t latency_ns[DELAY_TYPE_COUNT];  // Running average of the transfer completion time
+    uint64_t baseline_ns[DELAY_TYPE_COUNT]; // Same as above, at the built-in delay
+    char settled[DELAY_TYPE_COUNT];
+    char calibrating;
+} usbdelay_cal;
+
 struct usbdevice_;
 typedef struct usbdevice_ {
     // Function table (see command.h)
@@ -253,6 +329,8 @@ typedef struct usbdevice_ {
     // USB device
     struct udev_device* udev;
     int handle;
+    // Answered by usb_sim.c instead of a real device
+    char simulated;
     // uinput handles
     int uinput_kb, uinput_mouse;
     // keyboard led thread
@@ -310,6 +388,10 @@ typedef struct usbdevice_ {
     int infifo;
     // Notification FIFOs, or zero if a FIFO is closed
     int outfifo[OUTFIFO_MAX];
+    // Shared frame buffer, or null if the frame node is closed
+    ckb_frame* frame;
+    // Sequence number of the last frame that was applied
+    uint32_t frame_seq;
     // Features (see F_ macros)
     ushort features;
     // Whether the keyboard is being actively controlled by the driver
@@ -328,6 +410,8 @@ typedef struct usbdevice_ {
     uchar layout;
     // USB protocol delay (ms)
     long usbdelay_ns;
+    // Calibrated scale for the above, see usbdelay_calibrate()
+    usbdelay_cal delaycal;
     // Current input state
     usbinput input;
     // Indicator LED state
@@ -336,8 +420,10 @@ typedef struct usbdevice_ {
     char dither;
     // Keymap that should be applied to this device
     key keymap[sizeof(keymap)];
-    // Buffer used to store non-HID interrupt reads from the input thread.
-    uchar interruptbuf[MAX_MSG_SIZE];
+    // Open addressing table of key name -> keymap index + 1 (0 = empty slot). See findkey() in keymap_patch.h
+    short keyhash[KEY_HASH_SIZE];
+    // Queue of non-HID interrupt reads from the input thread.
+    intring interruptring;
     // Endpoints the main input thread should listen to
     // Must always end with 0, and endpoints should be 0x80 | i
     uchar input_endpoints[USB_EP_MAX+1];
@@ -345,6 +431,11 @@ typedef struct usbdevice_ {
     protocol_t protocol;
     // Poll thread
     pthread_t* pollthread;
+    // Macro scheduler thread, started on the first macro trigger. Plays the queued macros one at a time (see input.c)
+    pthread_t* macrothread;
+    struct _macro_param* macroqueue_head;
+    struct _macro_param* macroqueue_tail;
+    int shutdown_macrothread;
     // Size in bytes of the primary output endpoint
     int out_ep_packet_size;
 #ifndef NDEBUG
@@ -384,6 +475,7 @@ typedef struct usbdevice_ {
         BRIGHTNESS_HARDWARE_COARSE,
     } brightness_mode;
     struct timespec last_rgb;
+    devstats stats;
 } usbdevice;
 
 #endif  // STRUCTURES_H
@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Static tracepoints for the daemon's hot paths, under the "ckb_next" provider.
+// When built with USDT support each one is a single nop until a tracer (bpftrace, perf, systemtap) attaches to it.
+// Without it they compile to nothing. scripts/ckb-next-trace.bt captures them and scripts/ckb-next-trace-report.py
+// turns the capture into per-stage latencies.
+//
+// Tracepoints and their arguments:
+//  input_urb (dev, ep, len)            An input URB reached process_input_urb()
+//  input_urb_done (dev)                process_input_urb() returned to the input thread
+//  input_update (dev)                  inputupdate() started
+//  input_sync (dev, kb, mouse)         inputupdate() wrote its events to uinput
+//  readcmd_start (dev)                 A line from the cmd node is being parsed
+//  readcmd_end (dev)                   ...and was applied
+//  usb_send (dev, len, count)          _usbsend() started
+//  usb_send_done (dev, bytes)          _usbsend() finished, bytes is 0 on failure
+//  usb_recv (dev, len)                 _usbrecv() started
+//  usb_recv_done (dev, bytes)          _usbrecv() finished, bytes is 0 on failure
+//  mutex_wait (mutex)                  queued_mutex_lock() started
+//  mutex_acquired (mutex)              queued_mutex_lock() returned
+//  macro_action (dev, op)              A macro instruction (see macroop in structures.h) was executed
+
+#ifdef CKB_NEXT_USDT
+#include <sys/sdt.h>
+#define TRACE1(name, a)             DTRACE_PROBE1(ckb_next, name, a)
+#define TRACE2(name, a, b)          DTRACE_PROBE2(ckb_next, name, a, b)
+#define TRACE3(name, a, b, c)       DTRACE_PROBE3(ckb_next, name, a, b, c)
+#else
+#define TRACE1(name, a)             do {} while(0)
+#define TRACE2(name, a, b)          do {} while(0)
+#define TRACE3(name, a, b, c)       do {} while(0)
+#endif
+
+#endif  // TRACE_H
@@ -6,10 +6,12 @@
 #include "led.h"
 #include "notify.h"
 #include "profile.h"
+#include "reactor.h"
 #include "usb.h"
 #include "keymap_patch.h"
 #include <ckbnextconfig.h>
 #include "legacykb_proto.h"
+#include "trace.h"
 
 // Values taken from the official website
 // Mice not in the list default to 12000 in the GUI
@@ -329,6 +331,57 @@ cleanup:
     return 0;
 }
 
+#ifdef OS_LINUX
+// Partial lines from each device's cmd node, for devcmd_event(). Kept for the lifetime of the daemon and reset by devmain_reactor()
+static readlines_ctx* reactor_linectx[DEV_MAX];
+
+// Same as one iteration of devmain(), called by the reactor when the cmd node is readable
+static void devcmd_event(void* context){
+    usbdevice* kb = context;
+    wait_until_suspend_processed();
+    queued_mutex_lock(dmutex(kb));
+    // The device may have been closed while the event was queued
+    if(kb->status != DEV_STATUS_CONNECTED || !kb->infifo){
+        queued_mutex_unlock(dmutex(kb));
+        return;
+    }
+    readlines_ctx* linectx = reactor_linectx[INDEX_OF(kb, keyboard)];
+    if(readline_fifo(kb->infifo - 1, linectx) > 0 && readcmd(kb, linectx->buf)){
+        // USB transfer failed or command requested disconnect; destroy device
+        closeusb(kb);
+    }
+    queued_mutex_unlock(dmutex(kb));
+}
+
+// Hands the device over to the reactor instead of running devmain() on the setup thread, which then exits
+static void* devmain_reactor(usbdevice* kb){
+    /// \attention dmutex should still be locked when this is called
+    const int index = INDEX_OF(kb, keyboard);
+    if(!reactor_linectx[index])
+        reactor_linectx[index] = malloc(sizeof(readlines_ctx));
+    if(!reactor_linectx[index])
+        ckb_fatal("Failed to allocate memory for the cmd node of ckb%d", index);
+    else {
+        reactor_linectx[index]->leftover_bytes = 0;
+        reactor_linectx[index]->next_start = NULL;
+    }
+    // The reactor must never block on a read
+    const int kbfifo = kb->infifo - 1;
+    fcntl(kbfifo, F_SETFL, fcntl(kbfifo, F_GETFL) | O_NONBLOCK);
+    if(!reactor_linectx[index] || reactor_add(&mainreactor, kbfifo, EPOLLIN, devcmd_event, kb)
+            || (!kb->parent && !(IS_MOUSE_DEV(kb) || IS_MOUSEPAD_DEV(kb)) && os_reactorindicators(kb))){
+        closeusb(kb);
+        queued_mutex_unlock(dmutex(kb));
+        return 0;
+    }
+    // Nothing left to join in closeusb()
+    pthread_detach(kb->thread);
+    kb->thread = 0;
+    queued_mutex_unlock(dmutex(kb));
+    return 0;
+}
+#endif
+
 /// brief .
 ///
 /// \brief _setupusb A horrible function for setting up an usb device
@@ -386,6 +439,7 @@ static void* _setupusb(void* context){
     const devcmd* vt = get_vtable(kb);
     memcpy(&kb->vtable, vt, sizeof(devcmd));
     vt = &kb->vtable;
+    usbdelay_reset(kb);
 
     if(!(IS_DONGLE(kb) && kb->protocol == PROTO_BRAGI))
         kb->features = (IS_LEGACY(vendor, product) ? FEAT_STD_LEGACY : FEAT_STD_RGB) & features_mask;
@@ -513,6 +567,11 @@ static void* _setupusb(void* context){
 
     ///
     /// devmain()'s return value is returned by _setupusb() when we terminate.
+    /// With --reactor, the cmd node is handed over to the reactor instead and the thread ends here.
+#ifdef OS_LINUX
+    if(use_reactor)
+        return devmain_reactor(kb);
+#endif
     return devmain(kb);
     ///
     /// - The remaining code lines are the two exit labels as described above
@@ -627,6 +686,7 @@ int usb_tryreset(usbdevice* kb){
         return -1;
     ckb_info("Attempting reset...");
     while(1){
+        STATS_ADD(kb, usb_resets, 1);
         int res = resetusb(kb);
         if(!res){
             ckb_info("Reset success");
@@ -639,19 +699,152 @@ int usb_tryreset(usbdevice* kb){
     return -1;
 }
 
-// Wrapper around the vtable write() function for error handling and recovery
-int _usbsend(usbdevice* kb, void* messages, size_t msg_len, int count, const char* file, int line){
+/// \brief USB delay calibration
+///
+/// While calibrating, the scale of each delay type is lowered by DELAYCAL_STEP percent after a streak of good transfers.
+/// The first streak runs at the built-in delay and is used as the latency baseline.
+/// A failed transfer, or the average completion time doubling compared to the baseline, moves the scale back up by
+/// DELAYCAL_BACKOFF and settles that delay type. Outside of calibration any failure restores the built-in delay.
+#define DELAYCAL_MIN        20
+#define DELAYCAL_STEP       5
+#define DELAYCAL_BACKOFF    15
+// Indicator updates are rare, so they get a shorter streak
+static const uint delaycal_streak[DELAY_TYPE_COUNT] = { 256, 64, 8 };
+
+static void usbdelay_print(usbdevice* kb){
+    const ushort* scale = kb->delaycal.scale;
+    nprintf(kb, -1, 0, "usbdelay %hu:%hu:%hu\n", scale[DELAY_SEND], scale[DELAY_RECV], scale[DELAY_INDICATORS]);
+}
+
+void usbdelay_reset(usbdevice* kb){
+    memset(&kb->delaycal, 0, sizeof(kb->delaycal));
+    for(int i = 0; i < DELAY_TYPE_COUNT; i++)
+        kb->delaycal.scale[i] = 100;
+}
+
+void usbdelay_calibrate(usbdevice* kb){
+    if(kb->protocol != PROTO_NXP || IS_LEGACY_DEV(kb)){
+        ckb_warn("ckb%d: USB delay calibration is only supported on NXP devices", INDEX_OF(kb, keyboard));
+        return;
+    }
+    usbdelay_reset(kb);
+    // nxp_delay() doesn't wait before reads on these
+    kb->delaycal.settled[DELAY_RECV] = (kb->fwversion >= 0x120 || IS_V2_OVERRIDE(kb));
+    kb->delaycal.calibrating = 1;
+    ckb_info("ckb%d: Calibrating USB delays", INDEX_OF(kb, keyboard));
+}
+
+void usbdelay_stop(usbdevice* kb){
+    if(!kb->delaycal.calibrating)
+        return;
+    // Keep whatever has worked so far
+    kb->delaycal.calibrating = 0;
+    usbdelay_print(kb);
+}
+
+int usbdelay_restore(usbdevice* kb, const char* scales){
+    ushort scale[DELAY_TYPE_COUNT];
+    if(sscanf(scales, "%hu:%hu:%hu", scale + DELAY_SEND, scale + DELAY_RECV, scale + DELAY_INDICATORS) != DELAY_TYPE_COUNT)
+        return -1;
+    usbdelay_reset(kb);
+    for(int i = 0; i < DELAY_TYPE_COUNT; i++){
+        if(scale[i] < DELAYCAL_MIN)
+            scale[i] = DELAYCAL_MIN;
+        if(scale[i] < 100)
+            kb->delaycal.scale[i] = scale[i];
+    }
+    return 0;
+}
+
+uint64_t usbdelay_clock(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void usbdelay_result(usbdevice* kb, delay_type_t type, int ok, uint64_t latency_ns){
+    usbdelay_cal* cal = &kb->delaycal;
+    if(!USBDELAY_SCALED(kb))
+        return;
+    if(!cal->calibrating || cal->settled[type]){
+        if(!ok && cal->scale[type] < 100){
+            ckb_warn("ckb%d: USB transfer failed at %hu%% delay, reverting to the default", INDEX_OF(kb, keyboard), cal->scale[type]);
+            cal->scale[type] = 100;
+            usbdelay_print(kb);
+        }
+        return;
+    }
+
+    cal->latency_ns[type] = cal->latency_ns[type] ? (cal->latency_ns[type] * 7 + latency_ns) / 8 : latency_ns;
+    // The device is falling behind even though the transfers still succeed
+    if(ok && cal->baseline_ns[type] && cal->latency_ns[type] > cal->baseline_ns[type] * 2)
+        ok = 0;
+
+    if(!ok){
+        cal->scale[type] += DELAYCAL_BACKOFF;
+        if(cal->scale[type] > 100)
+            cal->scale[type] = 100;
+        cal->settled[type] = 1;
+    } else if(++cal->streak[type] >= delaycal_streak[type]){
+        cal->streak[type] = 0;
+        if(!cal->baseline_ns[type])
+            cal->baseline_ns[type] = cal->latency_ns[type];
+        if(cal->scale[type] >= DELAYCAL_MIN + DELAYCAL_STEP)
+            cal->scale[type] -= DELAYCAL_STEP;
+        else
+            cal->settled[type] = 1;
+    }
+
+    for(int i = 0; i < DELAY_TYPE_COUNT; i++){
+        if(!cal->settled[i])
+            return;
+    }
+    cal->calibrating = 0;
+    ckb_info("ckb%d: USB delay calibration finished", INDEX_OF(kb, keyboard));
+    usbdelay_print(kb);
+}
+
+// Adds a completed output transfer to the send latency histogram
+static void usbsend_stats(usbdevice* kb, int res, uint64_t latency_ns){
+    STATS_ADD(kb, usb_writes, 1);
+    STATS_ADD(kb, usb_bytes, res);
+    uint64_t us = latency_ns / 1000;
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if(bucket >= STATS_LATENCY_BUCKETS)
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    STATS_ADD(kb, send_latency[bucket], 1);
+}
+
+static int usbsend_retry(usbdevice* kb, void* messages, size_t msg_len, int count, int batch, const char* file, int line){
     int total_sent = 0;
-    for(int i = 0; i < count; i++){
+    int i = 0;
+    // Queue all of the messages at once if the caller allows it and the device supports it.
+    // Anything that wasn't sent is retried below, so this is only for messages that may arrive twice
+    if(batch && count > 1 && kb->vtable.write_batch){
+        // The latency only covers the transfers themselves, same as below, and not the delays between them
+        uint64_t latency = 0;
+        i = kb->vtable.write_batch(kb, messages, msg_len, count, &latency, file, line);
+        if(i){
+            usbdelay_result(kb, DELAY_SEND, i == (count < URB_BATCH_MAX ? count : URB_BATCH_MAX), latency);
+            for(int j = 0; j < i; j++)
+                usbsend_stats(kb, msg_len, latency);
+        }
+        total_sent = i * msg_len;
+    }
+    for(; i < count; i++){
         // Send each message via the OS function
         while(1){
             kb->vtable.delay(kb, DELAY_SEND);
             queued_mutex_lock(mmutex(kb)); ///< Synchonization between macro and color information
+            uint64_t start = usbdelay_clock();
             int res = kb->vtable.write(kb, messages + i * msg_len, msg_len, 0, file, line);
             queued_mutex_unlock(mmutex(kb));
+            uint64_t latency = usbdelay_clock() - start;
+            usbdelay_result(kb, DELAY_SEND, res > 0, latency);
             if(res == 0)
                 return 0;
             else if(res != -1){
+                usbsend_stats(kb, res, latency);
                 total_sent += res;
                 break;
             }
@@ -659,14 +852,14 @@ int _usbsend(usbdevice* kb, void* messages, size_t msg_len, int count, const cha
             if(reset_stop)
                 return 0;
             // Retry as long as the result is temporary failure
+            STATS_ADD(kb, usb_retries, 1);
             DELAY_100MS();
         }
     }
     return total_sent;
 }
 
-// Wrapper around the vtable write() and read() functions for error handling and recovery
-int _usbrecv(usbdevice* kb, void* out_msg, size_t msg_len, uchar* in_msg, const char* file, int line){
+static int usbrecv_retry(usbdevice* kb, void* out_msg, size_t msg_len, uchar* in_msg, const char* file, int line){
     // For now assume that msg_len is for both out_msg and in_msg
 
     // Try a maximum of 5 times
@@ -682,18 +875,22 @@ int _usbrecv(usbdevice* kb, void* out_msg, size_t msg_len, uchar* in_msg, const
             // Retry on temporary failure
             if (reset_stop)
                 return 0;
+            STATS_ADD(kb, usb_retries, 1);
             DELAY_100MS();
             continue;
         }
         // Wait for the response
         kb->vtable.delay(kb, DELAY_RECV);
+        uint64_t start = usbdelay_clock();
         res = kb->vtable.read(kb, in_msg, msg_len, 0, file, line);
+        usbdelay_result(kb, DELAY_RECV, res > 0, usbdelay_clock() - start);
         if(res == 0)
             return 0;
         else if(res != -1)
             return res;
         if(reset_stop)
             return 0;
+        STATS_ADD(kb, usb_retries, 1);
         DELAY_100MS();
     }
     // Give up
@@ -701,6 +898,30 @@ int _usbrecv(usbdevice* kb, void* out_msg, size_t msg_len, uchar* in_msg, const
     return 0;
 }
 
+// Wrapper around the vtable write() function for error handling and recovery
+int _usbsend(usbdevice* kb, void* messages, size_t msg_len, int count, const char* file, int line){
+    TRACE3(usb_send, INDEX_OF(kb, keyboard), msg_len, count);
+    int res = usbsend_retry(kb, messages, msg_len, count, 0, file, line);
+    TRACE2(usb_send_done, INDEX_OF(kb, keyboard), res);
+    return res;
+}
+
+// Same as _usbsend(), but queues the messages all at once where possible
+int _usbsend_batch(usbdevice* kb, void* messages, size_t msg_len, int count, const char* file, int line){
+    TRACE3(usb_send, INDEX_OF(kb, keyboard), msg_len, count);
+    int res = usbsend_retry(kb, messages, msg_len, count, 1, file, line);
+    TRACE2(usb_send_done, INDEX_OF(kb, keyboard), res);
+    return res;
+}
+
+// Wrapper around the vtable write() and read() functions for error handling and recovery
+int _usbrecv(usbdevice* kb, void* out_msg, size_t msg_len, uchar* in_msg, const char* file, int line){
+    TRACE2(usb_recv, INDEX_OF(kb, keyboard), msg_len);
+    int res = usbrecv_retry(kb, out_msg, msg_len, in_msg, file, line);
+    TRACE2(usb_recv_done, INDEX_OF(kb, keyboard), res);
+    return res;
+}
+
 /// \brief .
 ///
 /// An imutex lock ensures first of all, that no communication is currently running from the viewpoint of the driver to the user input device
@@ -762,6 +983,7 @@ int closeusb(usbdevice* kb){
     }
 
     queued_mutex_lock(imutex(kb));
+    macro_stopthread(kb);
     os_inputclose(kb);
 
     // Close USB device
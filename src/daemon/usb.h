@@ -291,6 +291,9 @@ const char* product_str(ushort product);
 // Used for devices that have the scroll wheel packet in the hardware hid packet only
 #define SW_PKT_HAS_NO_WHEEL(kb)                     ((kb)->vendor == V_CORSAIR && ((kb)->product == P_M55_RGB_PRO || (kb)->product == P_KATAR_PRO_XT || (kb)->product == P_KATAR_PRO))
 
+// Calibrated USB delays only apply to NXP devices, and never to the fixed 10ms used during setup, hardware loads and firmware updates
+#define USBDELAY_SCALED(kb)         ((kb)->protocol == PROTO_NXP && (kb)->usbdelay_ns < 10000000L)
+
 /// Start the USB main loop. Returns program exit code when finished
 int usbmain();
 
@@ -370,6 +373,13 @@ int _usbsend(usbdevice* kb, void* messages, size_t msg_len, int count, const cha
 /// \param[IN] count how many MSG_SIZE buffers is the logical message long?
 #define usbsend(kb, messages, msg_len, count) _usbsend(kb, messages, msg_len, count, __FILE_NOPATH__, __LINE__)
 
+/// \brief _usbsend_batch is _usbsend(), except that the messages may be queued all at once (see device_io_batch).
+///
+/// If one of them fails, the ones after it may already have been delivered and are sent again.
+/// So this is only for messages that can safely arrive twice, such as LED updates, and never for firmware transfers.
+int _usbsend_batch(usbdevice* kb, void* messages, size_t msg_len, int count, const char* file, int line);
+#define usbsend_batch(kb, messages, msg_len, count) _usbsend_batch(kb, messages, msg_len, count, __FILE_NOPATH__, __LINE__)
+
 ///
 /// \brief _usbrecv Request data from a USB device by first sending an output packet and then reading the response.
 /// \param kb THE usbdevice*
@@ -398,6 +408,28 @@ void print_urb_buffer(const char* prefix, const unsigned char* buffer, int actua
 
 int os_usb_control(usbdevice* kb, ctrltransfer* transfer, const char* file, int line);
 
+/// \brief usbdelay_reset goes back to the built-in USB delays and stops any calibration in progress
+void usbdelay_reset(usbdevice* kb);
+
+/// \brief usbdelay_calibrate starts lowering the USB delays of an NXP device until transfers fail or slow down.
+/// The result is printed to the notification nodes as "usbdelay send:recv:indicators" once every delay type has settled.
+void usbdelay_calibrate(usbdevice* kb);
+
+/// \brief usbdelay_stop ends a calibration early, keeping the delays that have worked so far
+void usbdelay_stop(usbdevice* kb);
+
+/// \brief usbdelay_restore applies scales previously printed by a calibration
+/// \return 0 on success, -1 if scales couldn't be parsed
+int usbdelay_restore(usbdevice* kb, const char* scales);
+
+/// \brief usbdelay_clock returns a monotonic timestamp in ns for usbdelay_result() and the send latency statistics
+uint64_t usbdelay_clock();
+
+/// \brief usbdelay_result feeds the outcome of a transfer that was preceded by a delay of the given type into the calibration
+/// \param ok whether the transfer succeeded
+/// \param latency_ns how long the transfer took to complete
+void usbdelay_result(usbdevice* kb, delay_type_t type, int ok, uint64_t latency_ns);
+
 // receive message from initial sighandler socketpair communication
 extern int sighandler_pipe[2];
 extern void exithandler(int type);
@@ -412,6 +444,9 @@ typedef struct _dpi_list {
 extern const dpi_list mouse_dpi_list[];
 
 int os_usb_interrupt_out(usbdevice* kb, unsigned int ep, unsigned int len, uchar* data, const char* file, int line);
+// Most packets os_usb_interrupt_out_batch() sends at once
+#define URB_BATCH_MAX 16
+int os_usb_interrupt_out_batch(usbdevice* kb, unsigned int ep, unsigned int len, uchar* data, int count, uint64_t* latency_ns, const char* file, int line);
 
 ///
 /// \brief Wait for devices to be reactivated after suspend.
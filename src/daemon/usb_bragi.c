@@ -42,10 +42,12 @@ int bragi_usb_write(usbdevice* kb, void* out, int len, int is_recv, const char*
 {
     BRAGI_PKT_SIZE_CHECK(len, file, line);
 
-    // If we need to read a response, lock the interrupt mutex
-    if(is_recv)
+    // If we need to read a response, lock the interrupt mutex and forget about any responses that arrived too late
+    if(is_recv){
         if(pthread_mutex_lock(intmutex(kb)))
             ckb_fatal("Error locking interrupt mutex in os_usbsend()");
+        intring_flush(kb);
+    }
 
     int res;
 
@@ -69,19 +71,13 @@ int bragi_usb_read(usbdevice* kb, void* in, int len, int dummy, const char* file
     BRAGI_PKT_SIZE_CHECK(len, file, line);
 
     // Wait for max 2s
-    int condret = cond_nanosleep(intcond(kb), intmutex(kb), 2000000000);
-    if(condret != 0){
-        if(pthread_mutex_unlock(intmutex(kb)))
-            ckb_fatal("Error unlocking interrupt mutex in os_usbrecv()");
-        if(condret == ETIMEDOUT)
-            ckb_warn_fn("ckb%d: Timeout while waiting for response", file, line, INDEX_OF(kb, keyboard));
-        else
-            ckb_warn_fn("Interrupt cond error %i", file, line, condret);
-        return -1;
-    }
-    memcpy(in, kb->interruptbuf, kb->out_ep_packet_size);
+    int res = intring_pop(kb, in, kb->out_ep_packet_size, 2000000000);
     if(pthread_mutex_unlock(intmutex(kb)))
         ckb_fatal("Error unlocking interrupt mutex in os_usbrecv()");
+    if(res){
+        ckb_warn_fn("ckb%d: Timeout while waiting for response", file, line, INDEX_OF(kb, keyboard));
+        return -1;
+    }
 
     return len;
 }
@@ -2,9 +2,13 @@
 #include "devnode.h"
 #include "input.h"
 #include "notify.h"
+#include "reactor.h"
+#include "trace.h"
 #include "usb.h"
+#include "usb_sim.h"
 
 #ifdef OS_LINUX
+#include <sys/timerfd.h>
 #include <time.h>
 
 // usb.c
@@ -17,6 +21,8 @@ static char kbsyspath[DEV_MAX][FILENAME_MAX];
 
 // USB IO functions
 int os_usb_control(usbdevice* kb, ctrltransfer* transfer, const char* file, int line) {
+    if(kb->simulated)
+        return sim_usb_control(kb, transfer, file, line);
 #ifdef DEBUG_USB_SEND
     const int ckb = INDEX_OF(kb, keyboard);
     ckb_info("ckb%d Control (%s:%d): bmRequestType: 0x%02hhx, bRequest: %hhu, wValue: 0x%04hx, wIndex: %04hx, wLength: %hu", ckb, file, line, transfer->bRequestType, transfer->bRequest, transfer->wValue, transfer->wIndex, transfer->wLength);
@@ -57,6 +63,8 @@ int os_usb_control(usbdevice* kb, ctrltransfer* transfer, const char* file, int
 
 int os_usb_interrupt_out(usbdevice* kb, unsigned int ep, unsigned int len, uchar* data, const char* file, int line)
 {
+    if(kb->simulated)
+        return sim_usb_interrupt_out(kb, ep, len, data, file, line);
 #ifdef DEBUG_USB_SEND
     print_urb_buffer("Sending:", data, (len > MSG_SIZE ? len : MSG_SIZE), file, line, __func__, INDEX_OF(kb, keyboard), (uchar)ep);
 #endif
@@ -75,33 +83,126 @@ int os_usb_interrupt_out(usbdevice* kb, unsigned int ep, unsigned int len, uchar
     return res;
 }
 
+/// Batched OUT transfers.
+/// The input thread (or the input reactor) reaps everything on the device handle, so the completions are handed back to the sender through urbmutex/urbcond.
+/// The URBs are kept here instead of on the sender's stack, because the kernel writes their status back when they are reaped,
+/// which may happen after the sender has given up waiting for them.
+typedef struct {
+    struct usbdevfs_urb urbs[URB_BATCH_MAX];
+    uint64_t submitted[URB_BATCH_MAX];  ///< usbdelay_clock() when each URB was submitted
+    uint64_t latency;                   ///< Sum of the submit to completion times of the successful URBs
+    int pending;    ///< Submitted, but not reaped yet
+    int done;       ///< Number of URBs that completed successfully, in order
+    char failed;
+    char reaper;    ///< Set while the input thread or reactor is reaping, as nothing would reap the URBs otherwise
+} urbbatch;
+static urbbatch outbatch[DEV_MAX];
+
+// Called by the input thread when it reaps one of the OUT URBs
+static void urbbatch_complete(usbdevice* kb, struct usbdevfs_urb* urb){
+    urbbatch* batch = outbatch + INDEX_OF(kb, keyboard);
+    pthread_mutex_lock(urbmutex(kb));
+    // URBs on the same endpoint complete in order, so anything after a failure has to be sent again
+    if(urb->status == 0 && !batch->failed){
+        batch->done++;
+        batch->latency += usbdelay_clock() - batch->submitted[urb - batch->urbs];
+    } else
+        batch->failed = 1;
+    batch->pending--;
+    pthread_cond_broadcast(urbcond(kb));
+    pthread_mutex_unlock(urbmutex(kb));
+}
+
+static void urbbatch_setreaper(usbdevice* kb, char reaper){
+    urbbatch* batch = outbatch + INDEX_OF(kb, keyboard);
+    pthread_mutex_lock(urbmutex(kb));
+    // Any URBs still pending are dropped along with the handle
+    batch->reaper = reaper;
+    batch->pending = 0;
+    pthread_cond_broadcast(urbcond(kb));
+    pthread_mutex_unlock(urbmutex(kb));
+}
+
 ///
-/// \brief os_inputmain This function is run in a separate thread and will be detached from the main thread, so it needs to clean up its own resources.
-/// \todo This function is a collection of many tasks. It should be divided into several sub-functions for the sake of greater convenience:
-///
-/// 1. set up an URB (Userspace Ressource Buffer) to communicate with the USBDEVFS_* ioctl()s
-/// 2. perform the ioctl()
-/// 3. interpretate the information got into the URB buffer or handle error situations and retry operation or leave the endless loop
-/// 4. inform the os about the data
-/// 5. loop endless via 2.
-/// 6. if endless loop has gone, deinitalize the interface, free buffers etc.
-/// 7. return null
+/// \brief os_usb_interrupt_out_batch queues up to count packets of len bytes as interrupt URBs and waits for all of them at once.
 ///
+/// Only used by _usbsend_batch(). The DELAY_SEND delay and the mmutex lock are applied before each packet exactly like in _usbsend(),
+/// only the wait for each transfer to finish before submitting the next one is gone.
+/// latency_ns is set to the mean time from submitting a packet to its completion, without the delays.
+/// \return the number of packets that were sent successfully. The caller is expected to send the rest one by one.
+int os_usb_interrupt_out_batch(usbdevice* kb, unsigned int ep, unsigned int len, uchar* data, int count, uint64_t* latency_ns, const char* file, int line){
+    // Simulated devices answer each packet right away, so there's nothing to gain
+    if(kb->simulated)
+        return 0;
+    urbbatch* batch = outbatch + INDEX_OF(kb, keyboard);
+    if(count > URB_BATCH_MAX)
+        count = URB_BATCH_MAX;
+
+    pthread_mutex_lock(urbmutex(kb));
+    // Don't touch the URBs while an earlier batch is still in flight
+    if(!batch->reaper || batch->pending){
+        pthread_mutex_unlock(urbmutex(kb));
+        return 0;
+    }
+    batch->done = 0;
+    batch->failed = 0;
+    batch->latency = 0;
+    pthread_mutex_unlock(urbmutex(kb));
 
-void* os_inputmain(void* context){
-    usbdevice* kb = context;
     int fd = kb->handle - 1;
-    int index = INDEX_OF(kb, keyboard);
-    ckb_info("Starting input thread for %s%d", devpath, index);
+    int submitted = 0;
+    for(; submitted < count; submitted++){
+        uchar* pkt = data + submitted * len;
+#ifdef DEBUG_USB_SEND
+        print_urb_buffer("Queueing:", pkt, (len > MSG_SIZE ? len : MSG_SIZE), file, line, __func__, INDEX_OF(kb, keyboard), (uchar)ep);
+#endif
+        // The kernel copies the data when the URB is submitted, so the buffer doesn't need to outlive this call
+        struct usbdevfs_urb* urb = batch->urbs + submitted;
+        memset(urb, 0, sizeof(*urb));
+        urb->type = USBDEVFS_URB_TYPE_INTERRUPT;
+        urb->endpoint = ep;
+        urb->buffer = pkt;
+        urb->buffer_length = len;
+
+        kb->vtable.delay(kb, DELAY_SEND);
+        queued_mutex_lock(mmutex(kb)); ///< Synchonization between macro and color information
+        pthread_mutex_lock(urbmutex(kb));
+        batch->submitted[submitted] = usbdelay_clock();
+        int res = ioctl(fd, USBDEVFS_SUBMITURB, urb);
+        int ioctlerrno = errno;
+        if(!res)
+            batch->pending++;
+        pthread_mutex_unlock(urbmutex(kb));
+        queued_mutex_unlock(mmutex(kb));
+        if(res){
+            ckb_err_fn("%s", file, line, strerror(ioctlerrno));
+            break;
+        }
+    }
 
-    if (kb->input_endpoints[0] == 0) {
-        ckb_err("No endpoints claimed in inputmain");
-        return 0;
+    pthread_mutex_lock(urbmutex(kb));
+    // Give the device as long as a synchronous transfer would get, then cancel whatever is left
+    int waited = 0;
+    while(batch->pending && batch->reaper && waited < 2){
+        if(cond_nanosleep(urbcond(kb), urbmutex(kb), 2500000000U) != ETIMEDOUT)
+            continue;
+        if(!waited++){
+            ckb_err_fn("Timed out waiting for %d of %d packets", file, line, batch->pending, submitted);
+            for(int i = 0; i < submitted; i++)
+                ioctl(fd, USBDEVFS_DISCARDURB, batch->urbs + i);
+        }
     }
+    int done = batch->done;
+    *latency_ns = done ? batch->latency / done : 0;
+    pthread_mutex_unlock(urbmutex(kb));
 
-    /// Get an usbdevfs_urb data structure and clear it via memset()
-    struct usbdevfs_urb urbs[USB_EP_MAX] = {0};
+    if(done < count)
+        ckb_warn_fn("Batched write sent %d of %d packets", file, line, done, count);
+    return done;
+}
 
+// Submits an interrupt URB for every input endpoint of the device. Returns the number of URBs.
+static int input_submit(usbdevice* kb, int fd, struct usbdevfs_urb* urbs){
     /// Query udev for wMaxPacketSize on each endpoint, due to certain devices sending more data than the max defined, causing all sorts of issues.
     /// A syspath example would be:
     /// $ cat "/sys/devices/pci0000:00/0000:00:05.0/0000:03:00.0/usb8/8-2/8-2:1.2/ep_03/wMaxPacketSize"
@@ -180,56 +281,213 @@ void* os_inputmain(void* context){
     } while (*(kb->input_endpoints + ifcount));
 
     udev_enumerate_unref(enumerate);
-    /// The userSpaceFS knows the URBs now, so start monitoring input
-    while (1) {
-        struct usbdevfs_urb* urb = NULL;
+    return ifcount;
+}
 
-        /// if the ioctl returns something != 0, let's have a deeper look what happened.
-        /// Broken devices or shutting down the entire system leads to closing the device and finishing this thread.
-        int res = ioctl(fd, USBDEVFS_REAPURB, &urb);
-        if (res) {
-            int ioctlerrno = errno;
-            wait_until_suspend_processed();
-            if (ioctlerrno == ENODEV || ioctlerrno == ENOENT || ioctlerrno == ESHUTDOWN)
-                // Stop the thread if the handle closes
-                break;
-            else if(ioctlerrno == EPIPE && urb){
-                /// If just an EPIPE ocurred, give the device a CLEAR_HALT and resubmit the URB.
-                ioctl(fd, USBDEVFS_CLEAR_HALT, &urb->endpoint);
-                // Re-submit the URB
-                if(urb)
-                    ioctl(fd, USBDEVFS_SUBMITURB, urb);
-                urb = NULL;
-            }
-            continue;
+// Handles the result of reaping one URB, with ioctlerrno being errno if res is non-zero. Returns 1 when input should stop.
+static int input_reaped(usbdevice* kb, int fd, int res, int ioctlerrno, struct usbdevfs_urb* urb, int index){
+    /// if the ioctl returns something != 0, let's have a deeper look what happened.
+    /// Broken devices or shutting down the entire system leads to closing the device and finishing this thread.
+    if (res) {
+        wait_until_suspend_processed();
+        if (ioctlerrno == ENODEV || ioctlerrno == ENOENT || ioctlerrno == ESHUTDOWN)
+            // Stop the thread if the handle closes
+            return 1;
+        else if(ioctlerrno == EPIPE && urb && !(urb->endpoint & 0x80)){
+            // Batched OUT transfers aren't resubmitted, the sender sends them again
+            urbbatch_complete(kb, urb);
+        }
+        else if(ioctlerrno == EPIPE && urb){
+            /// If just an EPIPE ocurred, give the device a CLEAR_HALT and resubmit the URB.
+            ioctl(fd, USBDEVFS_CLEAR_HALT, &urb->endpoint);
+            // Re-submit the URB
+            ioctl(fd, USBDEVFS_SUBMITURB, urb);
         }
+        return 0;
+    }
 
-        /// A correct REAPURB returns a Pointer to the URB which we now have a closer look into.
-        /// Lock all following actions with imutex.
-        ///
-        if (urb) {
-            // If we're shutting down, don't submit another urb, or try to process the data on this one
-            if(urb->status == -ESHUTDOWN && reset_stop)
-                break;
+    /// A correct REAPURB returns a Pointer to the URB which we now have a closer look into.
+    /// Lock all following actions with imutex.
+    ///
+    if (urb) {
+        /// OUT URBs can only come from os_usb_interrupt_out_batch(), so hand them back to the sender.
+        if(!(urb->endpoint & 0x80)){
+            urbbatch_complete(kb, urb);
+            return 0;
+        }
+        // If we're shutting down, don't submit another urb, or try to process the data on this one
+        if(urb->status == -ESHUTDOWN && reset_stop)
+            return 1;
 
-            process_input_urb(kb, urb->buffer, urb->actual_length, urb->endpoint);
+        process_input_urb(kb, urb->buffer, urb->actual_length, urb->endpoint);
+        TRACE1(input_urb_done, index);
 
-            /// Re-submit the URB for the next run.
-            if (ioctl(fd, USBDEVFS_SUBMITURB, urb)) {
-                wait_until_suspend_processed();
-            }
-            urb = NULL;
+        /// Re-submit the URB for the next run.
+        if (ioctl(fd, USBDEVFS_SUBMITURB, urb)) {
+            wait_until_suspend_processed();
         }
     }
+    return 0;
+}
 
-    ///
-    /// If the endless loop is terminated, clean up by discarding the URBs via ioctl(USBDEVFS_DISCARDURB),
-    /// free the URB buffers and return a null pointer as thread exit code.
-    ckb_info("Stopping input thread for %s%d", devpath, index);
+// Discards the input URBs and frees their buffers
+static void input_discard(int fd, struct usbdevfs_urb* urbs, int ifcount){
     for(int i = 0; i < ifcount; i++){
         ioctl(fd, USBDEVFS_DISCARDURB, urbs + i);
         free(urbs[i].buffer);
     }
+}
+
+/// Input URBs of a device that are reaped by the input reactor (--input-reactor) instead of its own thread.
+/// The kernel hands back the address an URB was submitted from, so they have to stay at the same place until the device is closed.
+typedef struct {
+    usbdevice* kb;
+    int fd;         ///< dup() of the device handle, kept open until the reactor is done with the URBs
+    int ifcount;
+    struct usbdevfs_urb urbs[USB_EP_MAX];
+} inputurbs;
+static inputurbs* inputstate[DEV_MAX];
+static pthread_mutex_t inputstate_mutex = PTHREAD_MUTEX_INITIALIZER;
+// os_closeusb() passes the inputurbs of closed devices to the reactor through this pipe, see inputreactor_release()
+static int inputclose_pipe[2] = { 0, 0 };
+
+// Called by the input reactor whenever URBs of the device have completed
+static void inputreactor_event(void* context){
+    inputurbs* state = context;
+    usbdevice* kb = state->kb;
+    const int index = INDEX_OF(kb, keyboard);
+    // The fd is edge-triggered, so everything that has completed must be reaped now
+    while(1){
+        struct usbdevfs_urb* urb = NULL;
+        int res = ioctl(state->fd, USBDEVFS_REAPURBNDELAY, &urb);
+        int ioctlerrno = errno;
+        if(res && ioctlerrno == EAGAIN)
+            return;
+        if(input_reaped(kb, state->fd, res, ioctlerrno, urb, index))
+            break;
+    }
+    // The URBs are freed once os_closeusb() hands them back
+    ckb_info("Stopping input for %s%d", devpath, index);
+    reactor_del(&inputreactor, state->fd);
+    pthread_mutex_lock(&inputstate_mutex);
+    // Unless the device was already closed, and a new one may be using the batch
+    if(inputstate[index] == state)
+        urbbatch_setreaper(kb, 0);
+    pthread_mutex_unlock(&inputstate_mutex);
+}
+
+// Called by the input reactor when os_closeusb() has handed back the URBs of a device
+static void inputreactor_free(void* context){
+    inputurbs* state;
+    if(read(inputclose_pipe[0], &state, sizeof(state)) != sizeof(state))
+        return;
+    reactor_del(&inputreactor, state->fd);
+    input_discard(state->fd, state->urbs, state->ifcount);
+    close(state->fd);
+    free(state);
+}
+
+// Hands the URBs over to the input reactor. Returns 0 on success.
+static int inputreactor_add(usbdevice* kb, int fd, inputurbs* state, int ifcount){
+    state->kb = kb;
+    state->ifcount = ifcount;
+    pthread_mutex_lock(&inputstate_mutex);
+    // Don't take over a handle that was closed (and possibly reused) while the URBs were submitted
+    if(kb->handle != fd + 1 || (state->fd = dup(fd)) == -1){
+        pthread_mutex_unlock(&inputstate_mutex);
+        return -1;
+    }
+    if(reactor_add(&inputreactor, state->fd, EPOLLOUT | EPOLLET, inputreactor_event, state)){
+        close(state->fd);
+        pthread_mutex_unlock(&inputstate_mutex);
+        return -1;
+    }
+    inputstate[INDEX_OF(kb, keyboard)] = state;
+    pthread_mutex_unlock(&inputstate_mutex);
+    return 0;
+}
+
+// Called by os_closeusb(). The reactor frees the URBs, as it may still be reaping them
+static void inputreactor_release(usbdevice* kb){
+    pthread_mutex_lock(&inputstate_mutex);
+    inputurbs* state = inputstate[INDEX_OF(kb, keyboard)];
+    inputstate[INDEX_OF(kb, keyboard)] = NULL;
+    pthread_mutex_unlock(&inputstate_mutex);
+    if(!state)
+        return;
+    urbbatch_setreaper(kb, 0);
+    if(write(inputclose_pipe[1], &state, sizeof(state)) != sizeof(state))
+        ckb_err("Unable to release the input URBs of %s%d: %s", devpath, INDEX_OF(kb, keyboard), strerror(errno));
+}
+
+// Starts the input reactor. Returns 0 on success.
+static int inputreactor_setup(){
+    if(reactor_init(&inputreactor))
+        return -1;
+    if(pipe2(inputclose_pipe, O_CLOEXEC)){
+        ckb_err("Unable to create the input reactor pipe: %s", strerror(errno));
+        return -1;
+    }
+    if(reactor_add(&inputreactor, inputclose_pipe[0], EPOLLIN, inputreactor_free, NULL))
+        return -1;
+    return reactor_start(&inputreactor, "input reactor", inputreactor_cpu, inputreactor_priority);
+}
+
+///
+/// \brief os_inputmain This function is run in a separate thread and will be detached from the main thread, so it needs to clean up its own resources.
+/// \todo This function is a collection of many tasks. It should be divided into several sub-functions for the sake of greater convenience:
+///
+/// 1. set up an URB (Userspace Ressource Buffer) to communicate with the USBDEVFS_* ioctl()s
+/// 2. perform the ioctl()
+/// 3. interpretate the information got into the URB buffer or handle error situations and retry operation or leave the endless loop
+/// 4. inform the os about the data
+/// 5. loop endless via 2.
+/// 6. if endless loop has gone, deinitalize the interface, free buffers etc.
+/// 7. return null
+///
+/// With --input-reactor, the thread ends after submitting the URBs and the input reactor reaps them instead.
+///
+
+void* os_inputmain(void* context){
+    usbdevice* kb = context;
+    if(kb->simulated)
+        return sim_inputmain(context);
+    int fd = kb->handle - 1;
+    int index = INDEX_OF(kb, keyboard);
+    ckb_info("Starting input thread for %s%d", devpath, index);
+
+    if (kb->input_endpoints[0] == 0) {
+        ckb_err("No endpoints claimed in inputmain");
+        return 0;
+    }
+
+    /// Get an usbdevfs_urb data structure and clear it via memset()
+    struct usbdevfs_urb stack_urbs[USB_EP_MAX] = {0};
+    inputurbs* state = use_inputreactor ? calloc(1, sizeof(inputurbs)) : NULL;
+    struct usbdevfs_urb* urbs = state ? state->urbs : stack_urbs;
+
+    int ifcount = input_submit(kb, fd, urbs);
+    urbbatch_setreaper(kb, 1);
+    if(state){
+        if(!inputreactor_add(kb, fd, state, ifcount))
+            return 0;
+        ckb_warn("Unable to hand %s%d over to the input reactor, reaping its input on this thread instead", devpath, index);
+    }
+    /// The userSpaceFS knows the URBs now, so start monitoring input
+    while (1) {
+        struct usbdevfs_urb* urb = NULL;
+        int res = ioctl(fd, USBDEVFS_REAPURB, &urb);
+        if(input_reaped(kb, fd, res, errno, urb, index))
+            break;
+    }
+
+    ///
+    /// If the endless loop is terminated, clean up by discarding the URBs via ioctl(USBDEVFS_DISCARDURB),
+    /// free the URB buffers and return a null pointer as thread exit code.
+    ckb_info("Stopping input thread for %s%d", devpath, index);
+    urbbatch_setreaper(kb, 0);
+    input_discard(fd, urbs, ifcount);
+    free(state);
     return 0;
 }
 
@@ -286,7 +544,13 @@ static int usbunclaim(usbdevice* kb, int resetting) {
 /// \n handle, udev and the first char of kbsyspath are cleared to 0 (empty string for kbsyspath).
 ///
 void os_closeusb(usbdevice* kb){
+    if(kb->simulated){
+        sim_closeusb(kb);
+        kbsyspath[INDEX_OF(kb, keyboard)][0] = 0;
+        return;
+    }
     if(kb->handle){
+        inputreactor_release(kb);
         usbunclaim(kb, 0);
         close(kb->handle - 1);
     }
@@ -363,6 +627,8 @@ static int usbclaim(usbdevice* kb){
 /// \todo it seems that no one wants to try the reset again. But I'v seen it somewhere...
 ///
 int os_resetusb(usbdevice* kb, const char* file, int line) {
+    if(kb->simulated)
+        return sim_resetusb(kb, file, line);
     TEST_RESET(usbunclaim(kb, 1));
     TEST_RESET(ioctl(kb->handle - 1, USBDEVFS_RESET));
     TEST_RESET(usbclaim(kb));
@@ -410,6 +676,8 @@ void strtrim(char* string){
 /// Claiming is the only point where os_setupusb() can produce an error (-1).
 ///
 int os_setupusb(usbdevice* kb) {
+    if(kb->simulated)
+        return sim_setupusb(kb);
     ///
     /// - Copy device description and serial
     struct udev_device* dev = kb->udev;
@@ -791,6 +1059,45 @@ void wait_until_suspend_processed() {
     pthread_mutex_unlock(&suspend_check_mutex);
 }
 
+static void udev_event(void* context){
+    struct udev_device* dev = udev_monitor_receive_device(context);
+    if(!dev)
+        return;
+    const char* action = udev_device_get_action(dev);
+    if(!action){
+        udev_device_unref(dev);
+        return;
+    }
+    // Add/remove device
+    if(!strcmp(action, "add")){
+        int res = usb_add_device(dev);
+        if(res == 0)
+            return;
+        // If the device matched but the handle wasn't opened correctly, re-enumerate (this sometimes solves the problem)
+        if(res == -1){
+            ckb_warn("Handle wasn't opened correctly. Trying again");
+            udev_enum();
+        }
+    } else if(!strcmp(action, "remove"))
+        usb_rm_device(dev);
+    udev_device_unref(dev);
+}
+
+// Called by the main reactor once per second to publish the device statistics
+static void statstimer_event(void* context){
+    uint64_t expirations;
+    if(read(*(int*)context, &expirations, sizeof(expirations)) == sizeof(expirations))
+        refresh_statsnodes();
+}
+
+static void sighandler_event(void* context){
+    (void)context;
+    // The signal handler passes the signal on through sighandler_pipe, handle it here where it is safe to shut down
+    int sighandler_msg;
+    if(read(sighandler_pipe[SIGHANDLER_RECEIVER], &sighandler_msg, sizeof(int)) == sizeof(int))
+        exithandler(sighandler_msg);
+}
+
 /// \brief .
 ///
 /// \brief usbmain is called by main() after setting up all other stuff.
@@ -804,6 +1111,13 @@ int usbmain(){
         ckb_fatal("Failed to initialize udev in usbmain(), usb_linux.c");
         return -1;
     }
+    // Devices join the reactor at the end of their setup, so it has to exist before they are enumerated
+    if(reactor_init(&mainreactor))
+        return -1;
+    if(use_inputreactor && inputreactor_setup()){
+        ckb_warn("Unable to start the input reactor, using one input thread per device");
+        use_inputreactor = 0;
+    }
 
     // Create thread that detects system suspend
     pthread_t suspend_thread;
@@ -813,6 +1127,7 @@ int usbmain(){
     ///
     /// Enumerate all currently connected devices
     udev_enum();
+    sim_enum();
 
     /// \todo lae. here the work has to go on...
     ///
@@ -820,55 +1135,28 @@ int usbmain(){
     struct udev_monitor* monitor = udev_monitor_new_from_netlink(udev, "udev");
     udev_monitor_filter_add_match_subsystem_devtype(monitor, "usb", 0);
     udev_monitor_enable_receiving(monitor);
-    // Get an fd for the monitor
-    int fd = udev_monitor_get_fd(monitor);
-    fd_set fds;
-
-    while(udev){
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        // Block until an event is read
-        if(select(fd + 1, &fds, 0, 0, 0) > 0 && FD_ISSET(fd, &fds)){
-            struct udev_device* dev = udev_monitor_receive_device(monitor);
-            if(!dev)
-                continue;
-            const char* action = udev_device_get_action(dev);
-            if(!action){
-                udev_device_unref(dev);
-                continue;
-            }
-            // Add/remove device
-            if(!strcmp(action, "add")){
-                int res = usb_add_device(dev);
-                if(res == 0)
-                    continue;
-                // If the device matched but the handle wasn't opened correctly, re-enumerate (this sometimes solves the problem)
-                if(res == -1){
-                    ckb_warn("Handle wasn't opened correctly. Trying again");
-                    udev_enum();
-                }
-            } else if(!strcmp(action, "remove"))
-                usb_rm_device(dev);
-            udev_device_unref(dev);
-        } else {
-            // if select returns -1 there is a chance that the waiting
-            // was interrupted by a signal
-            // check whether there is data available in the
-            // sighandler_pipe, read if there is and manually call the
-            // signal-handling routine
-            int sighandler_msg;
-            ioctl(sighandler_pipe[SIGHANDLER_RECEIVER], FIONREAD, &sighandler_msg);
-            if (sighandler_msg > 0){
-                int unused_result = read(sighandler_pipe[SIGHANDLER_RECEIVER], &sighandler_msg, sizeof(int));
-                exithandler(sighandler_msg);
-
-                // cast unused result to void to silence over-eager
-                // warning about unused variables:
-                // https://sourceware.org/bugzilla/show_bug.cgi?id=11959
-                (void) unused_result;
-            }
+    // The udev monitor and the signal pipe are handled by the reactor, along with the devices' cmd nodes with --reactor
+    reactor_add(&mainreactor, udev_monitor_get_fd(monitor), EPOLLIN, udev_event, monitor);
+    if(sighandler_pipe[SIGHANDLER_RECEIVER] > 0)
+        reactor_add(&mainreactor, sighandler_pipe[SIGHANDLER_RECEIVER], EPOLLIN, sighandler_event, NULL);
+    // The stats nodes are refreshed from here rather than when a command arrives, so they stay current without a client
+    int statstimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(statstimer >= 0){
+        struct itimerspec interval = { .it_interval = { .tv_sec = 1 }, .it_value = { .tv_sec = 1 } };
+        if(timerfd_settime(statstimer, 0, &interval, NULL) || reactor_add(&mainreactor, statstimer, EPOLLIN, statstimer_event, &statstimer)){
+            close(statstimer);
+            statstimer = -1;
         }
     }
+    if(statstimer < 0)
+        ckb_warn("Unable to create the stats timer, stats nodes won't be updated: %s", strerror(errno));
+
+    while(udev)
+        reactor_run(&mainreactor);
+    if(statstimer >= 0){
+        reactor_del(&mainreactor, statstimer);
+        close(statstimer);
+    }
     udev_monitor_unref(monitor);
     suspend_run = 0;
     pthread_join(suspend_thread, NULL);
@@ -150,9 +150,11 @@ int os_usbsend(usbdevice* kb, const uchar* out_msg, int is_recv, const char* fil
         usb_iface_t h_usb = kb->ifusb[ep];
         hid_dev_t h_hid = kb->ifhid[ep];
 
-        if(is_recv)
+        if(is_recv){
             if(pthread_mutex_lock(intmutex(kb)))
                 ckb_fatal("Error locking interrupt mutex in os_usbsend()");
+            intring_flush(kb);
+        }
 
         // Try sending an interrupt, and if that fails, fall back to setReport through the HID driver.
         // Needed for single EP devices.
@@ -190,20 +192,13 @@ int os_usbrecv(usbdevice* kb, uchar* in_msg, const char* file, int line){
     // Read the data from the input thread
     if((kb->fwversion >= 0x120 || IS_V2_OVERRIDE(kb))) {
         // Wait for 2s
-        int condret = cond_nanosleep(intcond(kb), intmutex(kb), 2000000000);
-        if(condret != 0){
-            if(pthread_mutex_unlock(intmutex(kb)))
-                ckb_fatal("Error unlocking interrupt mutex in os_usbrecv()");
-            if(condret == ETIMEDOUT)
-                ckb_warn_fn("ckb%d: Timeout while waiting for response", file, line, INDEX_OF(kb, keyboard));
-            else
-                ckb_warn_fn("Interrupt cond error %i", file, line, condret);
-            return -1;
-        }
-        memcpy(in_msg, kb->interruptbuf, MSG_SIZE);
-        memset(kb->interruptbuf, 0, MSG_SIZE);
+        int res = intring_pop(kb, in_msg, MSG_SIZE, 2000000000);
         if(pthread_mutex_unlock(intmutex(kb)))
             ckb_fatal("Error unlocking interrupt mutex in os_usbrecv()");
+        if(res){
+            ckb_warn_fn("ckb%d: Timeout while waiting for response", file, line, INDEX_OF(kb, keyboard));
+            return -1;
+        }
 
 #ifdef DEBUG_USB_RECV
         print_urb_buffer("Recv:", in_msg, MSG_SIZE, file, line, __func__);
@@ -988,6 +983,12 @@ CFMutableDictionaryRef create_hid_device_dict(){
     return match;
 }
 
+static void refresh_statstimer(CFRunLoopTimerRef timer, void* info){
+    (void)timer;
+    (void)info;
+    refresh_statsnodes();
+}
+
 int usbmain(){
     int vendor = V_CORSAIR;
 
@@ -1054,6 +1055,13 @@ int usbmain(){
 
 #endif
 
+    // Publish the device statistics once per second
+    CFRunLoopTimerRef statstimer = CFRunLoopTimerCreate(kCFAllocatorDefault,
+                                                        CFAbsoluteTimeGetCurrent() + 1, 1,
+                                                        0, 0,
+                                                        refresh_statstimer, NULL);
+    CFRunLoopAddTimer(mainloop, statstimer, kCFRunLoopCommonModes);
+
     io_iterator_t iterator_syspower = 0;
     IORegisterForSystemPower(NULL, &notify, powerEventCallback, &iterator_syspower);
     CFRunLoopAddSource(mainloop, IONotificationPortGetRunLoopSource(notify), kCFRunLoopDefaultMode);
@@ -18,10 +18,12 @@ int nxp_usb_write(usbdevice* kb, void* out, int len, int is_recv, const char* fi
     }
 
     if (kb->fwversion >= 0x120 || IS_V2_OVERRIDE(kb)){
-        // If we need to read a response, lock the interrupt mutex
-        if(is_recv)
+        // If we need to read a response, lock the interrupt mutex and forget about any responses that arrived too late
+        if(is_recv){
             if(pthread_mutex_lock(intmutex(kb)))
                 ckb_fatal("Error locking interrupt mutex in os_usbsend()");
+            intring_flush(kb);
+        }
 
         // All firmware versions for normal HID devices have the OUT endpoint at the end
         // Devices with no input, such as the Polaris, have it at the start.
@@ -38,6 +40,16 @@ int nxp_usb_write(usbdevice* kb, void* out, int len, int is_recv, const char* fi
     }
 }
 
+int nxp_usb_write_batch(usbdevice* kb, void* out, int len, int count, uint64_t* latency_ns, const char* file, int line)
+{
+    // Control transfers used by older firmware are left to nxp_usb_write()
+    if(len != 64 || !(kb->fwversion >= 0x120 || IS_V2_OVERRIDE(kb)))
+        return 0;
+
+    unsigned int ep = (IS_SINGLE_EP(kb) ? 1 : kb->epcount);
+    return os_usb_interrupt_out_batch(kb, ep, len, out, count, latency_ns, file, line);
+}
+
 int nxp_usb_read(usbdevice* kb, void* in, int len, int dummy, const char* file, int line)
 {
     if(len != 64)
@@ -48,20 +60,13 @@ int nxp_usb_read(usbdevice* kb, void* in, int len, int dummy, const char* file,
 
     if(kb->fwversion >= 0x120 || IS_V2_OVERRIDE(kb)){
         // Wait for max 2s
-        int condret = cond_nanosleep(intcond(kb), intmutex(kb), 2000000000);
-        if(condret != 0){
-            if(pthread_mutex_unlock(intmutex(kb)))
-                ckb_fatal("Error unlocking interrupt mutex in os_usbrecv()");
-            if(condret == ETIMEDOUT)
-                ckb_warn_fn("ckb%d: Timeout while waiting for response", file, line, INDEX_OF(kb, keyboard));
-            else
-                ckb_warn_fn("Interrupt cond error %i", file, line, condret);
-            return -1;
-        }
-        memcpy(in, kb->interruptbuf, len);
-        memset(kb->interruptbuf, 0, len);
+        int res = intring_pop(kb, in, len, 2000000000);
         if(pthread_mutex_unlock(intmutex(kb)))
             ckb_fatal("Error unlocking interrupt mutex in os_usbrecv()");
+        if(res){
+            ckb_warn_fn("ckb%d: Timeout while waiting for response", file, line, INDEX_OF(kb, keyboard));
+            return -1;
+        }
         return len;
     } else {
         ctrltransfer transfer = { 0xa1, 0x01, 0x0300, kb->epcount - 1, len, 5000, in };
@@ -0,0 +1,337 @@
+#include "device.h"
+#include "devnode.h"
+#include "keymap.h"
+#include "trace.h"
+#include "usb.h"
+#include "usb_sim.h"
+#include "bragi_proto.h"
+#include "nxp_proto.h"
+
+#ifdef OS_LINUX
+#include <poll.h>
+#include <sys/socket.h>
+
+#define SIM_REQUEST_MAX     16
+#define SIM_REPORT_MAX      64
+
+// A scripted input report
+typedef struct {
+    uint32_t delay_ms;
+    uchar ep;
+    uchar len;
+    uchar data[SIM_REPORT_MAX];
+} simreport;
+
+// Devices requested on the command line
+typedef struct {
+    ushort vendor, product;
+    int count;
+    simreport* reports;
+    int report_count;
+} simrequest;
+static simrequest simrequests[SIM_REQUEST_MAX];
+static int simrequest_count = 0;
+
+typedef struct {
+    // Responses travel to the input thread as one datagram each, the endpoint followed by the packet.
+    // [0] is read by the input thread, [1] is the device handle.
+    int sock[2];
+    const simrequest* request;
+    // Bragi state
+    uint32_t props[256];
+    ushort handles[256];    ///< Resource opened on each handle
+} simdevice;
+static simdevice simdev[DEV_MAX];
+
+static int sim_loadscript(simrequest* req, const char* path){
+    FILE* file = fopen(path, "r");
+    if(!file){
+        ckb_err_nofile("Unable to open input script %s: %s", path, strerror(errno));
+        return -1;
+    }
+    char line[1024];
+    int lineno = 0;
+    while(fgets(line, sizeof(line), file)){
+        lineno++;
+        char* pos = line;
+        while(isspace(*pos))
+            pos++;
+        if(!*pos || *pos == '#')
+            continue;
+        simreport report = { 0 };
+        int len = 0;
+        if(sscanf(pos, "%"SCNu32" %hhx%n", &report.delay_ms, &report.ep, &len) != 2){
+            ckb_err_nofile("%s:%d: Expected \"<delay> <endpoint> <bytes...>\"", path, lineno);
+            fclose(file);
+            return -1;
+        }
+        pos += len;
+        while(report.len < SIM_REPORT_MAX && sscanf(pos, " %hhx%n", report.data + report.len, &len) == 1){
+            report.len++;
+            pos += len;
+        }
+        if(!report.len)
+            continue;
+        simreport* reports = realloc(req->reports, (req->report_count + 1) * sizeof(simreport));
+        if(!reports){
+            fclose(file);
+            return -1;
+        }
+        req->reports = reports;
+        req->reports[req->report_count++] = report;
+    }
+    fclose(file);
+    return 0;
+}
+
+int sim_request(const char* spec){
+    if(simrequest_count == SIM_REQUEST_MAX)
+        return -1;
+    simrequest* req = simrequests + simrequest_count;
+    memset(req, 0, sizeof(*req));
+    req->count = 1;
+    int len = 0;
+    if(sscanf(spec, "%hx:%hx%n", &req->vendor, &req->product, &len) != 2)
+        return -1;
+    spec += len;
+    if(*spec == ':'){
+        if(sscanf(spec, ":%d%n", &req->count, &len) != 1 || req->count < 1)
+            return -1;
+        spec += len;
+    }
+    if(*spec == ':'){
+        if(sim_loadscript(req, spec + 1))
+            return -1;
+    } else if(*spec)
+        return -1;
+    simrequest_count++;
+    return 0;
+}
+
+static int sim_add(const simrequest* req){
+    // Find a free USB slot, just like a real device would
+    for(int index = 1; index < DEV_MAX; index++){
+        usbdevice* kb = keyboard + index;
+        if(queued_mutex_trylock(dmutex(kb)))
+            continue;
+        if(kb->status == DEV_STATUS_DISCONNECTED){
+            simdevice* sim = simdev + index;
+            if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sim->sock)){
+                ckb_err("Failed to create simulated device: %s", strerror(errno));
+                queued_mutex_unlock(dmutex(kb));
+                return -1;
+            }
+            sim->request = req;
+            memset(sim->props, 0, sizeof(sim->props));
+            memset(sim->handles, 0, sizeof(sim->handles));
+            sim->props[BRAGI_MODE] = BRAGI_MODE_HARDWARE;
+            sim->props[BRAGI_APP_VER] = 0x010000;
+            sim->props[BRAGI_POLLRATE] = BRAGI_POLLRATE_1MS;
+            sim->props[BRAGI_MAX_POLLRATE] = BRAGI_POLLRATE_1MS;
+            sim->props[BRAGI_BRIGHTNESS] = 1000;
+            sim->props[BRAGI_HWLAYOUT] = LAYOUT_ANSI;
+            sim->props[BRAGI_VID] = req->vendor;
+            sim->props[BRAGI_PID] = req->product;
+            sim->props[BRAGI_BATTERY_LEVEL] = 1000;
+
+            kb->simulated = 1;
+            kb->handle = sim->sock[1] + 1;
+            kb->vendor = req->vendor;
+            kb->product = req->product;
+            kb->status = DEV_STATUS_CONNECTING;
+            // Mutex remains locked
+            setupusb(kb);
+            return 0;
+        }
+        queued_mutex_unlock(dmutex(kb));
+    }
+    ckb_err("No free devices");
+    return -1;
+}
+
+void sim_enum(){
+    for(int i = 0; i < simrequest_count; i++){
+        const simrequest* req = simrequests + i;
+        ckb_info("Adding %d simulated device%s with vendor = 0x%x, product = 0x%x", req->count, req->count == 1 ? "" : "s", req->vendor, req->product);
+        for(int j = 0; j < req->count; j++){
+            if(sim_add(req))
+                return;
+        }
+    }
+}
+
+int sim_setupusb(usbdevice* kb){
+    int index = INDEX_OF(kb, keyboard);
+    snprintf(kb->name, KB_NAME_LEN, "Simulated %s %s", vendor_str(kb->vendor), product_str(kb->product));
+    snprintf(kb->serial, SERIAL_LEN, "SIM%04X%04X%02d", kb->vendor, kb->product, index);
+    kb->fwversion = (kb->protocol == PROTO_BRAGI ? 0 : 0x300);
+    // Enough interfaces for every input endpoint the protocol handlers pick
+    kb->epcount = (IS_SINGLE_EP(kb) ? 1 : 4);
+    ckb_info("Connecting %s at %s%d", kb->name, devpath, index);
+    return 0;
+}
+
+int sim_resetusb(usbdevice* kb, const char* file, int line){
+    (void)kb;
+    (void)file;
+    (void)line;
+    return 0;
+}
+
+void sim_closeusb(usbdevice* kb){
+    if(kb->handle){
+        // The input thread sees the end of the stream and closes its side
+        shutdown(kb->handle - 1, SHUT_RDWR);
+        close(kb->handle - 1);
+    }
+    kb->handle = 0;
+    kb->simulated = 0;
+}
+
+int sim_usb_control(usbdevice* kb, ctrltransfer* transfer, const char* file, int line){
+#ifdef DEBUG_USB_SEND
+    ckb_info("ckb%d Simulated control (%s:%d): bmRequestType: 0x%02hhx, bRequest: %hhu, wValue: 0x%04hx, wIndex: %04hx, wLength: %hu", INDEX_OF(kb, keyboard), file, line, transfer->bRequestType, transfer->bRequest, transfer->wValue, transfer->wIndex, transfer->wLength);
+#else
+    (void)kb;
+    (void)file;
+    (void)line;
+#endif
+    // Reads return zeros, writes are dropped
+    if((transfer->bRequestType & 0x80) && transfer->wLength)
+        memset(transfer->data, 0, transfer->wLength);
+    return transfer->wLength;
+}
+
+// Fills in the response to an NXP packet. Returns 0 if the packet doesn't have one.
+static int sim_nxp_response(usbdevice* kb, const uchar* pkt, uchar* response){
+    if(pkt[0] != CMD_GET)
+        return 0;
+    memcpy(response, pkt, 4);
+    ushort vendor = kb->vendor, product = kb->product, version = kb->fwversion;
+    switch(pkt[1]){
+    case FIELD_IDENT:
+        memcpy(response + 8, &version, 2);
+        memcpy(response + 12, &vendor, 2);
+        memcpy(response + 14, &product, 2);
+        response[16] = 1;                   // 1ms poll rate
+        response[23] = LAYOUT_ANSI - 1;
+        break;
+    case 0xae:
+        // Wireless identification
+        memcpy(response + 4, &vendor, 2);
+        memcpy(response + 6, &product, 2);
+        memcpy(response + 8, &version, 2);
+        break;
+    }
+    return 1;
+}
+
+// Fills in the response to a Bragi packet. Every request succeeds.
+static int sim_bragi_response(simdevice* sim, const uchar* pkt, uchar* response){
+    response[0] = pkt[0];
+    response[1] = pkt[1];
+    switch(pkt[1]){
+    case BRAGI_GET:{
+        uint32_t value = sim->props[pkt[2]];
+        response[3] = value & 0xff;
+        response[4] = (value >> 8) & 0xff;
+        response[5] = (value >> 16) & 0xff;
+        break;
+    }
+    case BRAGI_SET:
+        sim->props[pkt[2]] = pkt[4] | (pkt[5] << 8);
+        break;
+    case BRAGI_OPEN_HANDLE:
+        sim->handles[pkt[2]] = pkt[3] | (pkt[4] << 8);
+        break;
+    case BRAGI_CLOSE_HANDLE:
+        sim->handles[pkt[3]] = 0;
+        break;
+    case BRAGI_PROBE_HANDLE:{
+        // Only the pairing ID has any data to read, and it's all zeros
+        uint32_t size = (sim->handles[pkt[2]] == BRAGI_RES_PAIRINGID ? PAIR_ID_SIZE : 0);
+        memcpy(response + 5, &size, sizeof(size));
+        break;
+    }
+    }
+    return 1;
+}
+
+int sim_usb_interrupt_out(usbdevice* kb, unsigned int ep, unsigned int len, uchar* data, const char* file, int line){
+#ifdef DEBUG_USB_SEND
+    print_urb_buffer("Sending (simulated):", data, (len > MSG_SIZE ? len : MSG_SIZE), file, line, __func__, INDEX_OF(kb, keyboard), (uchar)ep);
+#else
+    (void)file;
+    (void)line;
+#endif
+    if(!kb->handle)
+        return 0;
+    simdevice* sim = simdev + INDEX_OF(kb, keyboard);
+    uchar response[BRAGI_JUMBO_SIZE + 1] = { 0 };
+    int respond;
+    if(kb->protocol == PROTO_BRAGI){
+        response[0] = kb->bragi_in_ep;
+        respond = sim_bragi_response(sim, data, response + 1);
+    } else {
+        response[0] = 0x80 | ep;
+        respond = sim_nxp_response(kb, data, response + 1);
+    }
+    if(respond && send(kb->handle - 1, response, kb->out_ep_packet_size + 1, MSG_NOSIGNAL) < 0)
+        return 0;
+    return len;
+}
+
+void* sim_inputmain(void* context){
+    usbdevice* kb = context;
+    int index = INDEX_OF(kb, keyboard);
+    simdevice* sim = simdev + index;
+    const simrequest* req = sim->request;
+    int fd = sim->sock[0];
+    ckb_info("Starting simulated input thread for %s%d", devpath, index);
+
+    uchar buffer[BRAGI_JUMBO_SIZE + 1];
+    int next = 0;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if(req->report_count)
+        timespec_add(&deadline, req->reports[0].delay_ms * 1000000LL);
+    while(1){
+        // Wait for a response or the next scripted report, whichever comes first
+        int timeout = -1;
+        if(req->report_count){
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout = 0;
+            if(timespec_gt(deadline, now))
+                timeout = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int res = poll(&pfd, 1, timeout);
+        if(res < 0){
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(res > 0){
+            ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+            // The handle was closed
+            if(len <= 0)
+                break;
+            process_input_urb(kb, buffer + 1, len - 1, buffer[0]);
+            TRACE1(input_urb_done, index);
+            continue;
+        }
+        const simreport* report = req->reports + next;
+        memcpy(buffer, report->data, report->len);
+        process_input_urb(kb, buffer, report->len, report->ep);
+        TRACE1(input_urb_done, index);
+        next = (next + 1) % req->report_count;
+        timespec_add(&deadline, req->reports[next].delay_ms * 1000000LL);
+    }
+
+    ckb_info("Stopping simulated input thread for %s%d", devpath, index);
+    close(fd);
+    return 0;
+}
+
+#endif
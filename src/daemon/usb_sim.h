@@ -0,0 +1,32 @@
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#include "includes.h"
+#include "usb.h"
+
+// Simulated USB devices (Linux only).
+// These are answered in-process instead of by the hardware, so the whole daemon (device nodes, commands, lighting,
+// input and macros) can be run and load-tested without any Corsair devices attached.
+// The os_* functions in usb_linux.c hand simulated devices over to the sim_* functions below.
+//
+// Devices are requested with --simulate=<vid>:<pid>[:<count>[:<script>]].
+// NXP devices answer identification and other reads with the request header, Bragi devices keep a property table
+// and accept every handle. Everything else is acknowledged and dropped.
+// The optional script is replayed in a loop as input reports, one per line: "<delay in ms> <endpoint> <bytes...>",
+// with the endpoint and bytes in hex. Empty lines and lines starting with # are skipped.
+
+/// \brief sim_request queues simulated devices described by an --simulate argument. Returns 0 on success.
+int sim_request(const char* spec);
+
+/// \brief sim_enum connects the requested simulated devices. Called by usbmain() after enumerating the real ones.
+void sim_enum();
+
+// Backend for simulated devices, see the matching os_* functions
+int sim_usb_control(usbdevice* kb, ctrltransfer* transfer, const char* file, int line);
+int sim_usb_interrupt_out(usbdevice* kb, unsigned int ep, unsigned int len, uchar* data, const char* file, int line);
+void* sim_inputmain(void* context);
+int sim_setupusb(usbdevice* kb);
+int sim_resetusb(usbdevice* kb, const char* file, int line);
+void sim_closeusb(usbdevice* kb);
+
+#endif  // USB_SIM_H
@@ -0,0 +1,150 @@
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include "animplugin.h"
+#ifdef __GLIBC__
+#include <dlfcn.h>
+#endif
+
+template<typename T> static bool resolve(void* handle, const char* name, T& func){
+#ifdef __GLIBC__
+    func = reinterpret_cast<T>(dlsym(handle, name));
+#else
+    func = nullptr;
+#endif
+    return func != nullptr;
+}
+
+QAtomicInt AnimPlugin::_instances;
+
+AnimPlugin::AnimPlugin(void* handle) :
+    _handle(handle), _ctx(nullptr), _lastFrame(0), _durationMsec(1000), _absoluteTime(false), _ended(false)
+{
+}
+
+AnimPlugin* AnimPlugin::open(const QString& path, const QList<QByteArray>& names, const QList<int>& x, const QList<int>& y,
+                             quint64 timestamp){
+#ifdef __GLIBC__
+    if(!QFile::exists(path))
+        return nullptr;
+    // Leave the rest to processes, see MAX_INSTANCES. The count goes down again when an instance is deleted
+    if(_instances.fetchAndAddOrdered(1) >= MAX_INSTANCES){
+        _instances.fetchAndAddOrdered(-1);
+        return nullptr;
+    }
+    // Load the library into a new namespace, so that every instance has its own globals.
+    void* handle = dlmopen(LM_ID_NEWLM, QFile::encodeName(path).constData(), RTLD_NOW | RTLD_LOCAL);
+    if(!handle){
+        qDebug() << "Couldn't load" << path << dlerror();
+        _instances.fetchAndAddOrdered(-1);
+        return nullptr;
+    }
+    AnimPlugin* plugin = new AnimPlugin(handle);
+    if(!resolve(handle, "ckb_plugin_abi", plugin->_abi) || plugin->_abi() != PLUGIN_ABI
+            || !resolve(handle, "ckb_plugin_open", plugin->_open)
+            || !resolve(handle, "ckb_plugin_parameter", plugin->_parameter)
+            || !resolve(handle, "ckb_plugin_start", plugin->_start)
+            || !resolve(handle, "ckb_plugin_time", plugin->_time)
+            || !resolve(handle, "ckb_plugin_keypress", plugin->_keypress)
+            || !resolve(handle, "ckb_plugin_frame", plugin->_frame)
+            || !resolve(handle, "ckb_plugin_close", plugin->_close)){
+        qDebug() << path << "is not a compatible animation plugin";
+        delete plugin;
+        return nullptr;
+    }
+    // Start the animation
+    int count = names.count();
+    QVector<const char*> namePtrs(count);
+    for(int i = 0; i < count; i++)
+        namePtrs[i] = names.at(i).constData();
+    QVector<int> xs = x.toVector(), ys = y.toVector();
+    plugin->_ctx = plugin->_open(count, namePtrs.constData(), xs.constData(), ys.constData());
+    if(!plugin->_ctx){
+        delete plugin;
+        return nullptr;
+    }
+    plugin->_argb.fill(0, count * 4);
+    plugin->_lastFrame = timestamp;
+    return plugin;
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(names);
+    Q_UNUSED(x);
+    Q_UNUSED(y);
+    Q_UNUSED(timestamp);
+    return nullptr;
+#endif
+}
+
+AnimPlugin::~AnimPlugin(){
+#ifdef __GLIBC__
+    if(_ctx)
+        _close(_ctx);
+    dlclose(_handle);
+    _instances.fetchAndAddOrdered(-1);
+#endif
+}
+
+void AnimPlugin::parameter(const QByteArray& name, const QByteArray& value){
+    QMutexLocker locker(&_mutex);
+    _parameter(_ctx, name.constData(), value.constData());
+}
+
+void AnimPlugin::start(bool state){
+    QMutexLocker locker(&_mutex);
+    _start(_ctx, state);
+}
+
+void AnimPlugin::duration(int durationMsec, bool absoluteTime){
+    QMutexLocker locker(&_mutex);
+    _durationMsec = durationMsec;
+    _absoluteTime = absoluteTime;
+}
+
+void AnimPlugin::advance(quint64 timestamp){
+    QMutexLocker locker(&_mutex);
+    advanceLocked(timestamp);
+}
+
+void AnimPlugin::advanceLocked(quint64 timestamp){
+    // Same as AnimScript::advance() does for processes
+    if(timestamp <= _lastFrame)
+        return;
+    double delta = (timestamp - _lastFrame) / (double)_durationMsec;
+    if(!_absoluteTime){
+        // Skip any complete durations
+        while(delta > 1.){
+            _time(_ctx, 1.);
+            delta--;
+        }
+    }
+    _time(_ctx, delta);
+    _lastFrame = timestamp;
+}
+
+void AnimPlugin::keypress(const QByteArray& name, int x, int y, bool state){
+    QMutexLocker locker(&_mutex);
+    _keypress(_ctx, name.isEmpty() ? nullptr : name.constData(), x, y, state);
+}
+
+bool AnimPlugin::frame(quint64 timestamp, QRgb* colors, const QVector<int>& index){
+    QMutexLocker locker(&_mutex);
+    uchar* argb = reinterpret_cast<uchar*>(_argb.data());
+    // Like a process, the animation stops after delivering its last frame
+    if(!_ended){
+        advanceLocked(timestamp);
+        _ended = _frame(_ctx, argb) != 0;
+    }
+    int count = qMin(index.count(), _argb.size() / 4);
+    for(int i = 0; i < count; i++, argb += 4){
+        int key = index.at(i);
+        if(key >= 0)
+            colors[key] = qRgba(argb[1], argb[2], argb[3], argb[0]);
+    }
+    return _ended;
+}
+
+bool AnimPlugin::ended(){
+    QMutexLocker locker(&_mutex);
+    return _ended;
+}
@@ -0,0 +1,75 @@
+#ifndef ANIMPLUGIN_H
+#define ANIMPLUGIN_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QRgb>
+#include <QString>
+#include <QVector>
+
+// In-process animation, loaded from an animation built with CKB_PLUGIN (see ckb-next/animation.h).
+// Each instance gets its own copy of the library, since animations keep their state in global variables.
+// Used by AnimScript instead of running the animation program when possible, for up to MAX_INSTANCES at a time.
+// Besides AnimScript on the GUI thread, KbRenderer advances and draws the animation on its own thread. Every call is
+// serialised, and the instance keeps its own time so that both can advance it.
+
+class AnimPlugin
+{
+public:
+    // Loads the plugin and starts the animation for the given keys. Returns null if the plugin can't be used,
+    // in which case the animation should be run as a process instead.
+    // The timestamp is the animation's starting time.
+    static AnimPlugin* open(const QString& path, const QList<QByteArray>& names, const QList<int>& x, const QList<int>& y,
+                            quint64 timestamp);
+    ~AnimPlugin();
+
+    void parameter(const QByteArray& name, const QByteArray& value);
+    void start(bool state);
+    // Length of one animation cycle, see AnimScript::setDuration()
+    void duration(int durationMsec, bool absoluteTime);
+    // Advances the animation to the given time, if it's later than the last one
+    void advance(quint64 timestamp);
+    // Key event by name (position is ignored) or by position (name is empty)
+    void keypress(const QByteArray& name, int x, int y, bool state);
+    // Advances the animation and writes its next frame to colors, at the given index for each key (-1 to skip it).
+    // Returns true if the animation has ended, after which the last frame is written again.
+    bool frame(quint64 timestamp, QRgb* colors, const QVector<int>& index);
+    bool ended();
+
+    // Each copy of the library comes with its own libc in a new link map namespace, and takes a share of the static TLS
+    // space that glibc keeps for dlopen(). Once that runs out (after about a dozen copies), loading anything else that
+    // uses initial-exec TLS fails as well, including Qt plugins and GL drivers. So only a few animations run in-process.
+    static const int MAX_INSTANCES = 6;
+
+private:
+    struct ckb_runctx;
+    AnimPlugin(void* handle);
+
+    static QAtomicInt _instances;
+
+    void*       _handle;
+    ckb_runctx* _ctx;
+    QMutex      _mutex;
+    // A, R, G, B for each key, from the last frame
+    QByteArray  _argb;
+    quint64     _lastFrame;
+    int         _durationMsec;
+    bool        _absoluteTime, _ended;
+
+    void advanceLocked(quint64 timestamp);
+
+    // Must match the ckb_plugin_* functions in animation.h
+    static const int PLUGIN_ABI = 1;
+    int         (*_abi)();
+    ckb_runctx* (*_open)(unsigned, const char* const*, const int*, const int*);
+    void        (*_parameter)(ckb_runctx*, const char*, const char*);
+    void        (*_start)(ckb_runctx*, int);
+    void        (*_time)(ckb_runctx*, double);
+    void        (*_keypress)(ckb_runctx*, const char*, int, int, int);
+    int         (*_frame)(ckb_runctx*, uchar*);
+    void        (*_close)(ckb_runctx*);
+};
+
+#endif // ANIMPLUGIN_H
@@ -59,6 +59,9 @@ void AnimScript::scan(){
             if(file.endsWith("ckb-next") || file.endsWith("ckb-next-daemon"))
                 continue;
 #endif
+            // Animation plugins are loaded by the instances of the corresponding program
+            if(file.endsWith(".so"))
+                continue;
             AnimScript* script = new AnimScript(qApp, dir.absoluteFilePath(file));
             if(script->load() && !scripts.contains(script->_info.guid) && script->presets().count()){
                 scripts[script->_info.guid] = script;
@@ -283,10 +286,12 @@ void AnimScript::setDuration(){
             durationMsec = -1;
         repeatMsec = round(_paramValues.value("repeat").toDouble() * 1000.);
     }
+    if(plugin)
+        plugin->duration(durationMsec, _info.absoluteTime);
 }
 
 void AnimScript::parameters(const QMap<QString, QVariant>& paramValues){
-    if(!initialized || !process || !_info.liveParams)
+    if(!initialized || (!process && !plugin) || !_info.liveParams)
         return;
     _paramValues = paramValues;
     setDuration();
@@ -294,6 +299,14 @@ void AnimScript::parameters(const QMap<QString, QVariant>& paramValues){
 }
 
 void AnimScript::printParams(){
+    if(plugin){
+        QMapIterator<QString, QVariant> i(_paramValues);
+        while(i.hasNext()){
+            i.next();
+            plugin->parameter(i.key().toLatin1(), i.value().toString().toUtf8());
+        }
+        return;
+    }
     process->write("begin params\n");
     QMapIterator<QString, QVariant> i(_paramValues);
     while(i.hasNext()){
@@ -311,7 +324,7 @@ int AnimScript::begin(quint64 timestamp){
     if(!initialized)
         return 1;
     end();
-    stopped = firstFrame = readFrame = readAnyFrame = inFrame = false;
+    stopped = firstFrame = readFrame = readAnyFrame = inFrame = inBinFrame = false;
     // Determine the upper left corner of the given keys
     QStringList keysCopy = _keys;
     minX = INT_MAX;
@@ -332,6 +345,30 @@ int AnimScript::begin(quint64 timestamp){
         firstFrame = readFrame = readAnyFrame = true;
         return 1;
     }
+    // Map the keys to the color buffer for binary frames
+    _binFrameIndex.clear();
+    foreach(const QString& key, keysCopy){
+        const QRgb* inMap = _colorBuffer.colorForName(key.toLatin1().constData());
+        _binFrameIndex.append(inMap ? inMap - _colorBuffer.colors() : -1);
+    }
+    _binFrame.resize(keysCopy.count() * 4);
+    lastFrame = timestamp;
+    // Load the animation in-process if possible
+    QList<QByteArray> names;
+    QList<int> x, y;
+    foreach(const QString& key, keysCopy){
+        const Key& pos = _map.key(key);
+        names.append(key.toLatin1());
+        x.append(pos.x - minX);
+        y.append(pos.y - minY);
+    }
+    plugin = QSharedPointer<AnimPlugin>(AnimPlugin::open(_path + ".so", names, x, y, timestamp));
+    if(plugin){
+        plugin->duration(durationMsec, _info.absoluteTime);
+        qDebug() << "Loaded" << _path << "in-process";
+        printParams();
+        return 0;
+    }
     process = new QProcess(this);
     process->setReadChannel(QProcess::StandardOutput);
     connect(process, SIGNAL(readyReadStandardOutput()), this, SLOT(readProcess()));
@@ -341,16 +378,15 @@ int AnimScript::begin(quint64 timestamp){
     // Write the keymap to the process
     process->write("begin keymap\n");
     process->write(QString("keycount %1\n").arg(keysCopy.count()).toLatin1());
-    foreach(const QString& key, keysCopy){
-        const Key& pos = _map.key(key);
-        process->write(QString("key %1 %2,%3\n").arg(key).arg(pos.x - minX).arg(pos.y - minY).toLatin1());
-    }
+    for(int i = 0; i < keysCopy.count(); i++)
+        process->write(QString("key %1 %2,%3\n").arg(keysCopy.at(i)).arg(x.at(i)).arg(y.at(i)).toLatin1());
+    // Offer binary frames. Older animations skip anything they don't know about up to "end keymap" and keep using text
+    process->write("frameformat binary\n");
     process->write("end keymap\n");
     // Write parameters
     printParams();
     // Begin animating
     process->write("begin run\n");
-    lastFrame = timestamp;
     return 0;
 }
 
@@ -360,25 +396,31 @@ void AnimScript::retrigger(quint64 timestamp, bool allowPreempt){
     if(allowPreempt && _info.preempt && repeatMsec > 0)
         // If preemption is wanted, trigger the animation 1 duration in the past first
         retrigger(timestamp - repeatMsec);
-    if(!process && begin(timestamp))
+    if(!process && !plugin && begin(timestamp))
         return;
     advance(timestamp);
-    process->write("start\n");
+    if(plugin)
+        plugin->start(true);
+    else
+        process->write("start\n");
 }
 
 void AnimScript::stop(quint64 timestamp){
     if(!initialized)
         return;
-    if(!process && begin(timestamp))
+    if(!process && !plugin && begin(timestamp))
         return;
     advance(timestamp);
-    process->write("stop\n");
+    if(plugin)
+        plugin->start(false);
+    else
+        process->write("stop\n");
 }
 
 void AnimScript::keypress(const QString& key, bool pressed, quint64 timestamp){
     if(!initialized)
         return;
-    if(!process && begin(timestamp))
+    if(!process && !plugin && begin(timestamp))
         return;
     int kpMode = _info.kpMode;
     if(_paramValues.value("kpmode", 0).toInt() != 0)
@@ -395,7 +437,10 @@ void AnimScript::keypress(const QString& key, bool pressed, quint64 timestamp){
     case KP_NAME:
         // Print keypress by name
         advance(timestamp);
-        process->write(("key " + key + (pressed ? " down\n" : " up\n")).toLatin1());
+        if(plugin)
+            plugin->keypress(key.toLatin1(), 0, 0, pressed);
+        else
+            process->write(("key " + key + (pressed ? " down\n" : " up\n")).toLatin1());
         break;
     case KP_POSITION:
         // Print keypress by position
@@ -403,13 +448,17 @@ void AnimScript::keypress(const QString& key, bool pressed, quint64 timestamp){
         if(!kp)
             return;
         advance(timestamp);
-        process->write(("key " + QString("%1,%2").arg(kp.x - minX).arg(kp.y - minY) + (pressed ? " down\n" : " up\n")).toLatin1());
+        if(plugin)
+            plugin->keypress(QByteArray(), kp.x - minX, kp.y - minY, pressed);
+        else
+            process->write(("key " + QString("%1,%2").arg(kp.x - minX).arg(kp.y - minY) + (pressed ? " down\n" : " up\n")).toLatin1());
         break;
     }
 }
 
 void AnimScript::end(){
     _colors.clear();
+    plugin.clear();
     if(process){
         process->kill();
         connect(process, SIGNAL(finished(int)), process, SLOT(deleteLater()));
@@ -433,12 +482,25 @@ void AnimScript::readProcessErr(){
 }
 
 void AnimScript::readProcess(){
-    while(process->canReadLine()){
+    while(true){
+        if(inBinFrame){
+            // Binary frame: ARGB bytes for each key, in the order the keys were sent. Wait until all of them have arrived
+            if(process->bytesAvailable() < _binFrame.size())
+                return;
+            process->read(_binFrame.data(), _binFrame.size());
+            readBinFrame(reinterpret_cast<const uchar*>(_binFrame.constData()));
+            inBinFrame = false;
+        }
+        if(!process->canReadLine())
+            return;
         QByteArray line = process->readLine().trimmed();
         if(!inFrame){
             // Ignore anything not between "begin frame" and "end frame", except for "end run", which indicates that the program is done.
+            // "begin binframe" is followed directly by a binary frame.
             if(line == "begin frame")
                 inFrame = true;
+            else if(line == "begin binframe")
+                inBinFrame = true;
             else if(line == "end run"){
                 stopped = true;
                 return;
@@ -465,13 +527,35 @@ void AnimScript::readProcess(){
     }
 }
 
+void AnimScript::readBinFrame(const uchar* argb){
+    int count = _binFrameIndex.count();
+    QRgb* colors = _colorBuffer.colors();
+    for(int i = 0; i < count; i++, argb += 4){
+        int index = _binFrameIndex.at(i);
+        if(index >= 0)
+            colors[index] = qRgba(argb[1], argb[2], argb[3], argb[0]);
+    }
+    // Copy color buffer back to the atomic map
+    memcpy(_colors.colors(), _colorBuffer.colors(), sizeof(QRgb) * _colors.count());
+    readFrame = readAnyFrame = true;
+}
+
 void AnimScript::frame(quint64 timestamp){
     if(!initialized || stopped)
         return;
     // Start the animation if it's not running yet
-    if(!process)
+    if(!process && !plugin)
         begin(timestamp);
 
+    if(plugin){
+        // Plugins deliver frames immediately
+        if(plugin->frame(timestamp, _colorBuffer.colors(), _binFrameIndex))
+            stopped = true;
+        memcpy(_colors.colors(), _colorBuffer.colors(), sizeof(QRgb) * _colors.count());
+        firstFrame = readFrame = readAnyFrame = true;
+        return;
+    }
+
     if(process){
         advance(timestamp);
 
@@ -483,7 +567,23 @@ void AnimScript::frame(quint64 timestamp){
     readFrame = false;
 }
 
+QSharedPointer<AnimPlugin> AnimScript::framePlugin(quint64 timestamp){
+    if(initialized && !stopped && !process && !plugin)
+        begin(timestamp);
+    if(!plugin || stopped || plugin->ended()){
+        frame(timestamp);
+        return QSharedPointer<AnimPlugin>();
+    }
+    firstFrame = readFrame = readAnyFrame = true;
+    return plugin;
+}
+
 void AnimScript::advance(quint64 timestamp){
+    // Plugins keep their own time, since the render thread advances them too
+    if(plugin){
+        plugin->advance(timestamp);
+        return;
+    }
     // Don't do anything if the time hasn't actually advanced.
     if(timestamp <= lastFrame)
         return;
@@ -5,10 +5,13 @@
 #include <QObject>
 #include <QMap>
 #include <QProcess>
+#include <QSharedPointer>
+#include <QVector>
 #include <QUuid>
 #include <QVariant>
 #include "keymap.h"
 #include "colormap.h"
+#include "animplugin.h"
 
 // Class for tracking an animation script. Has a global list of all possible scripts, and can also provide instances to launch the process and communicate with it.
 // See also: KbAnim, KbLight
@@ -90,6 +93,9 @@ public:
     void keypress(const QString& key, bool pressed, quint64 timestamp);
     // Executes the next frame of the animation.
     void frame(quint64 timestamp);
+    // Like frame(), but returns the animation instead of drawing the frame if it runs in-process. Its frames can then be
+    // drawn by any thread, into a copy of colors() at binFrameIndex().
+    QSharedPointer<AnimPlugin> framePlugin(quint64 timestamp);
     // Ends the animation.
     void end();
 
@@ -98,6 +104,8 @@ public:
 
     // Colors returned from the last executed frame.
     const ColorMap& colors() const { return _colors; }
+    // Color map index of each key in the animation
+    const QVector<int>& binFrameIndex() const { return _binFrameIndex; }
 
     ~AnimScript();
 
@@ -140,15 +148,21 @@ private:
     // Animation state
     quint64     lastFrame;
     int         durationMsec, repeatMsec;
-    bool        initialized :1, firstFrame :1, readFrame :1, readAnyFrame :1, stopped :1, inFrame :1;
+    bool        initialized :1, firstFrame :1, readFrame :1, readAnyFrame :1, stopped :1, inFrame :1, inBinFrame :1;
     QProcess*   process;
+    // Used instead of the process if the animation is available as a plugin. Shared with the render threads
+    QSharedPointer<AnimPlugin> plugin;
     ColorMap    _colorBuffer;
+    // Color map index of each key sent to the animation, in the order of binary frames
+    QVector<int> _binFrameIndex;
+    QByteArray  _binFrame;
 
     // Helper functions
     void setDuration();
     void printParams();
     int begin(quint64 timestamp);
     void advance(quint64 timestamp);
+    void readBinFrame(const uchar* argb);
 
     // Global script list
     static QHash<QUuid, AnimScript*> scripts;
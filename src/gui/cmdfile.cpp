@@ -0,0 +1,53 @@
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <QMutexLocker>
+#include "cmdfile.h"
+
+CmdFile::CmdFile(const QString& name) :
+    QFile(name)
+{
+}
+
+qint64 CmdFile::writeData(const char* data, qint64 len){
+    // Only ever called from the GUI thread
+    _pending.append(data, len);
+    return len;
+}
+
+bool CmdFile::commit(){
+    if(_pending.isEmpty() || !isOpen())
+        return true;
+    QMutexLocker locker(&_writeMutex);
+    const char* data = _pending.constData();
+    qint64 left = _pending.size();
+    // Anything longer than PIPE_BUF may be written in parts, so keep going until it's all out.
+    // Give up if the daemon stops reading for a second, like a blocking write would have hung.
+    while(left > 0){
+        ssize_t res = ::write(handle(), data, left);
+        if(res > 0){
+            data += res;
+            left -= res;
+            continue;
+        }
+        if(res < 0 && errno == EINTR)
+            continue;
+        struct pollfd pfd = { handle(), POLLOUT, 0 };
+        if(res < 0 && errno == EAGAIN && poll(&pfd, 1, 1000) > 0)
+            continue;
+        break;
+    }
+    _pending.clear();
+    return left == 0;
+}
+
+void CmdFile::close(){
+    commit();
+    QFile::close();
+}
+
+bool CmdFile::writeLine(const QByteArray& line){
+    QMutexLocker locker(&_writeMutex);
+    // Writes of up to PIPE_BUF bytes to a FIFO are all or nothing
+    return isOpen() && ::write(handle(), line.constData(), line.size()) == line.size();
+}
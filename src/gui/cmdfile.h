@@ -0,0 +1,33 @@
+#ifndef CMDFILE_H
+#define CMDFILE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+
+// The daemon's cmd node, opened non-blocking.
+// The GUI thread and the device's render thread both write to it, so anything written from the GUI thread is held
+// back until commit() and then written out as a whole, and writeLine() waits for that to finish. Lines from the two
+// threads can't end up in the middle of each other, no matter how long the GUI's commands are.
+
+class CmdFile : public QFile
+{
+public:
+    CmdFile(const QString& name);
+
+    // Writes everything since the last commit(). QFile::flush() doesn't, it never sees the data held back here.
+    bool commit();
+    void close() override;
+    // Writes a short line (up to PIPE_BUF bytes) right away, from any thread. If the daemon isn't keeping up the line
+    // is dropped, and false is returned.
+    bool writeLine(const QByteArray& line);
+
+protected:
+    qint64 writeData(const char* data, qint64 len) override;
+
+private:
+    QMutex      _writeMutex;
+    QByteArray  _pending;
+};
+
+#endif // CMDFILE_H
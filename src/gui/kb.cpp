@@ -39,7 +39,7 @@ Kb::Kb(QObject *parent, const QString& path) :
     batteryTimer(nullptr), batteryIcon(nullptr), showBatteryIndicator(false), devpath(path), cmdpath(path + "/cmd"), notifyPath(path + "/notify1"), macroPath(path + "/notify2"),
     _currentProfile(nullptr), _currentMode(nullptr), _model(KeyMap::NO_MODEL), batteryLevel(0), batteryStatus(BatteryStatus::BATT_STATUS_UNKNOWN),
     _hwProfile(nullptr), prevProfile(nullptr), prevMode(nullptr),
-    cmd(cmdpath), notifyNumber(1), macroNumber(2), _needsSave(false), _layout(KeyMap::NO_LAYOUT), _maxDpi(0),
+    cmd(cmdpath), renderer(path + "/frame"), notifyNumber(1), macroNumber(2), _needsSave(false), _layout(KeyMap::NO_LAYOUT), _maxDpi(0),
     deviceIdleTimer()
 {
     memset(iState, 0, sizeof(iState));
@@ -143,7 +143,7 @@ Kb::Kb(QObject *parent, const QString& path) :
         notifyPaths.insert(notifyPath);
     }
     cmd.write(QString("notifyon %1\n").arg(notifyNumber).toLatin1());
-    cmd.flush();
+    cmd.commit();
 
     if(features.contains("battery")){
         batteryIcon = new BatteryStatusTrayIcon(usbModel, this);
@@ -174,6 +174,15 @@ Kb::Kb(QObject *parent, const QString& path) :
     // Activate device, apply settings, and ask for hardware profile
     cmd.write(QString("fps %1\n").arg(_frameRate).toLatin1());
     cmd.write(QString("dither %1\n").arg(static_cast<int>(_dither)).toLatin1());
+    // Ask for the shared frame node. Older daemons ignore this and keep getting "rgb" commands
+    if(features.contains("rgb")){
+        cmd.write("frame on\n");
+        renderer.start(&cmd);
+    }
+    // Restore previously calibrated USB delays. The daemon reverts to its defaults if they cause errors
+    QString usbDelay = CkbSettings::get(prefsPath + "/usbDelay").toString();
+    if(!usbDelay.isEmpty())
+        cmd.write(QString("usbdelay %1\n").arg(usbDelay).toLatin1());
 #ifdef Q_OS_MACOS
     // Write ANSI/ISO flag to daemon (OSX only)
     cmd.write("layout ");
@@ -190,7 +199,7 @@ Kb::Kb(QObject *parent, const QString& path) :
     }
     // Ask for current indicator and key state
     cmd.write(" get :i :keys\n");
-    cmd.flush();
+    cmd.commit();
 
     emit infoUpdated();
     activeDevices.insert(this);
@@ -213,10 +222,11 @@ Kb::~Kb(){
 
     // Kill notification thread and remove node
     activeDevices.remove(this);
+    renderer.stop();
     if(cmd.isOpen() && notifyNumber > 0){
-        cmd.write(QString("idle\nnotifyoff %1\n").arg(notifyNumber).toLatin1());
+        cmd.write(QString("idle\nframe off\nnotifyoff %1\n").arg(notifyNumber).toLatin1());
         // Manually flush so that the daemon closes the notify pipe and the thread can gracefully stop
-        cmd.flush();
+        cmd.commit();
     }
     if(!wait(1000)){
         terminate();
@@ -234,7 +244,7 @@ void Kb::frameRate(int newFrameRate){
     _frameRate = newFrameRate;
     foreach(Kb* kb, activeDevices){
         kb->cmd.write(QString("fps %1\n").arg(newFrameRate).toLatin1());
-        kb->cmd.flush();
+        kb->cmd.commit();
     }
 }
 
@@ -252,7 +262,7 @@ void Kb::updateLayout(bool stop){
     cmd.write("layout ");
     cmd.write(KeyMap::isISO(_layout) ? "iso" : "ansi");
     cmd.write("\n");
-    cmd.flush();
+    cmd.commit();
 #endif
     foreach(KbProfile* profile, _profiles)
         profile->keyMap(getKeyMap());
@@ -268,7 +278,7 @@ void Kb::updateLayout(bool stop){
 
 void Kb::updateBattery(){
     cmd.write(QString("@%1 get :battery\n").arg(notifyNumber).toLatin1());
-    cmd.flush();
+    cmd.commit();
 }
 
 void Kb::dither(bool newDither){
@@ -278,7 +288,7 @@ void Kb::dither(bool newDither){
     // Update all devices
     foreach(Kb* kb, activeDevices){
         kb->cmd.write(QString("dither %1\n").arg(static_cast<int>(newDither)).toLatin1());
-        kb->cmd.flush();
+        kb->cmd.commit();
     }
 }
 
@@ -290,7 +300,7 @@ void Kb::mouseAccel(bool newAccel){
     // Update all devices
     foreach(Kb* kb, activeDevices){
         kb->cmd.write(QString("accel %1\n").arg(QString(newAccel ? "on" : "off")).toLatin1());
-        kb->cmd.flush();
+        kb->cmd.commit();
     }
 #endif
 }
@@ -303,7 +313,7 @@ void Kb::scrollSpeed(int newSpeed){
     // Update all devices
     foreach(Kb* kb, activeDevices){
         kb->cmd.write(QString("scrollspeed %1\n").arg(newSpeed).toLatin1());
-        kb->cmd.flush();
+        kb->cmd.commit();
     }
 #endif
 }
@@ -422,7 +432,7 @@ void Kb::hwSave(){
 
     // Save the profile to memory
     cmd.write("hwsave\n");
-    cmd.flush();
+    cmd.commit();
 }
 
 bool Kb::needsSave() const {
@@ -499,10 +509,10 @@ void Kb::frameUpdate(){
     if(prevMode != _currentMode || changed)
         cmd.write(QString("mode %1 switch ").arg(index + 1).toLatin1());
     perf->applyIndicators(index, iState);
-    light->frameUpdate(cmd, monochrome);
+    light->frameUpdate(cmd, monochrome, features.contains("rgb") ? &renderer : nullptr, index);
     bind->update(cmd, notifyNumber, changed);
     perf->update(cmd, notifyNumber, changed, true);
-    cmd.flush();
+    cmd.commit();
 }
 
 void Kb::deletePrevious(){
@@ -612,7 +622,7 @@ void Kb::readNotify(const QString& line){
             newProfile = new KbProfile(this, getKeyMap(), guid, modified);
             hwLoading[0] = true;
             cmd.write(QString("@%1 get :hwprofilename\n").arg(notifyNumber).toLatin1());
-            cmd.flush();
+            cmd.commit();
         } else {
             // If it's been updated, fetch its name
             if(newProfile->id().hwModifiedString() != modified){
@@ -621,7 +631,7 @@ void Kb::readNotify(const QString& line){
                 newProfile->setNeedsSave();
                 if(hwLoading[0]){
                     cmd.write(QString("@%1 get :hwprofilename\n").arg(notifyNumber).toLatin1());
-                    cmd.flush();
+                    cmd.commit();
                 }
             } else {
                 hwLoading[0] = false;
@@ -693,7 +703,7 @@ void Kb::readNotify(const QString& line){
                 if(isMouse())
                     cmd.write(" :hwdpi :hwdpisel :hwlift :hwsnap");
                 cmd.write("\n");
-                cmd.flush();
+                cmd.commit();
             }
         } else if(components[2] == "hwname"){
             // Mode name - update list
@@ -842,6 +852,9 @@ void Kb::readNotify(const QString& line){
             QStringList numbers = res.split("/");
             emit fwUpdateProgress(numbers[0].toInt(), numbers[1].toInt());
         }
+    } else if(components[0] == "usbdelay"){
+        // USB delays calibrated by the daemon. Sent back whenever the device is connected
+        CkbSettings::set(prefsPath + "/usbDelay", components[1]);
     }
 }
 
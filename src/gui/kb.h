@@ -6,6 +6,8 @@
 #include <QThread>
 #include <QTimer>
 #include "kbprofile.h"
+#include "cmdfile.h"
+#include "kbrenderer.h"
 #include <QElapsedTimer>
 #include <limits>
 #include "batterysystemtrayicon.h"
@@ -251,7 +253,9 @@ private:
     void writeProfileHeader();
 
     // cmd and notify file handles
-    QFile cmd;
+    CmdFile cmd;
+    // Render thread writing to the shared frame node, used for lighting instead of "rgb" when the daemon supports it
+    KbRenderer renderer;
 
     /// \brief notifyNumber is the trailing number in the device path.
     int notifyNumber;
@@ -3,6 +3,7 @@
 #include <QDebug>
 #include "ckbsettings.h"
 #include "kbanim.h"
+#include "kbblend.h"
 #include <typeinfo>
 
 KbAnim::KbAnim(QObject* parent, const KeyMap& map, const QUuid id, CkbSettingsBase& settings) :
@@ -329,40 +330,6 @@ bool KbAnim::isRunning() const {
     return _script->hasFrame();
 }
 
-// Blending functions
-
-static float blendNormal(float bg, float fg){
-    return fg;
-}
-
-static float blendAdd(float bg, float fg){
-    float res = bg + fg;
-    if(res > 1.f)
-        res = 1.f;
-    return res;
-}
-
-static float blendSubtract(float bg, float fg){
-    float res = bg - fg;
-    if(res < 0.f)
-        res = 0.f;
-    return res;
-}
-
-static float blendMultiply(float bg, float fg){
-    return bg * fg;
-}
-
-static float blendDivide(float bg, float fg){
-    float res = bg / fg;
-    if(res > 1.f)
-        res = 1.f;
-    return res;
-}
-
-typedef float (*blendFunc)(float,float);
-static blendFunc functions[5] = { blendNormal, blendAdd, blendSubtract, blendMultiply, blendDivide };
-
 void KbAnim::blend(ColorMap& animMap, quint64 timestamp){
     if(!_script)
         return;
@@ -372,46 +339,25 @@ void KbAnim::blend(ColorMap& animMap, quint64 timestamp){
     _script->frame(timestamp);
 
     // Blend the script's map with the current map
-    int blendMode = (int)_mode;
-    blendFunc blendF = functions[blendMode];
-    float fOpacity = _opacity / 255.f;  // save some math by pre-dividing the 255 for qAlpha
-
     const ColorMap& scriptMap = _script->colors();
     int count = animMap.count();
     if(scriptMap.count() != count){
         qDebug() << "Script map didn't match base map (" << count << " vs " << scriptMap.count() << "). This should never happen.";
         return;
     }
-    QRgb* background = animMap.colors();
-    const QRgb* foreground = scriptMap.colors();
-    for(int i = 0; i < count; i++){
-        // Mix the colors in with the color map according to blend mode and alpha
-        QRgb& bg = background[i];
-        QRgb fg = foreground[i];
-        int alpha = qAlpha(fg);
-        if(alpha == 0)
-            continue;
-        if(blendMode == 0){
-            // Blend: normal
-            // This is the most common use case and it requires much less arithmetic
-            if(alpha == 255){
-                bg = fg;
-            } else {
-                float r = qRed(bg), g = qGreen(bg), b = qBlue(bg);
-                float a = alpha * fOpacity;
-                r = r * (1.f - a) + qRed(fg) * a;
-                g = g * (1.f - a) + qGreen(fg) * a;
-                b = b * (1.f - a) + qBlue(fg) * a;
-                bg = qRgb(std::round(r), std::round(g), std::round(b));
-            }
-        } else {
-            // Use blend function
-            float r = qRed(bg) / 255.f, g = qGreen(bg) / 255.f, b = qBlue(bg) / 255.f;
-            float a = alpha * fOpacity;
-            r = r * (1.f - a) + blendF(r, qRed(fg) / 255.f) * a;
-            g = g * (1.f - a) + blendF(g, qGreen(fg) / 255.f) * a;
-            b = b * (1.f - a) + blendF(b, qBlue(fg) / 255.f) * a;
-            bg = qRgb(std::round(r * 255.f), std::round(g * 255.f), std::round(b * 255.f));
-        }
-    }
+    blendColors(animMap.colors(), scriptMap.colors(), count, (int)_mode, _opacity);
+}
+
+bool KbAnim::layer(KbRenderer::Layer& layer, quint64 timestamp){
+    if(!_script)
+        return false;
+
+    // Fetch the next frame from the script, unless the render thread draws it
+    catchUp(timestamp);
+    layer.plugin = _script->framePlugin(timestamp);
+    layer.index = _script->binFrameIndex();
+    layer.colors = _script->colors();
+    layer.mode = (int)_mode;
+    layer.opacity = _opacity;
+    return true;
 }
@@ -5,6 +5,7 @@
 #include "ckbsettings.h"
 #include "animscript.h"
 #include "keymap.h"
+#include "kbrenderer.h"
 
 // Animation instance for a lighting mode.
 
@@ -66,6 +67,8 @@ public:
 
     // Blends the animation into a color map, taking opacity and mode into account
     void blend(ColorMap &animMap, quint64 timestamp);
+    // Like blend(), but leaves blending to the render thread. Returns false if there's nothing to blend
+    bool layer(KbRenderer::Layer& layer, quint64 timestamp);
 
     // Animation properties
     inline const QUuid&     guid() const                    { return _guid; }
@@ -196,7 +196,7 @@ void KbBind::setAction(const QString& key, const QString& action){
     _bind[rKey] = new KeyAction(action, this);
 }
 
-void KbBind::update(QFile& cmd, int notify, bool force){
+void KbBind::update(CmdFile& cmd, int notify, bool force){
     if(!force && !_needsUpdate && lastGlobalRemapTime == globalRemapTime)
         return;
     lastGlobalRemapTime = globalRemapTime;
@@ -290,7 +290,7 @@ void KbBind::handleNotificationChannel(bool start) {
         } else {
             lastCmd->write (QString("\n@%1 notify all:off\nnotifyoff %1\n").arg(getMacroNumber()).toLatin1());
         }
-        lastCmd->flush();
+        lastCmd->commit();
     } else qDebug() << QString("No cmd or valid handle for notification found, macroNumber = %1, lastCmd = %2")
                        .arg(getMacroNumber()).arg(lastCmd? "set" : "unset");
 }
@@ -1,11 +1,11 @@
 #ifndef KBBIND_H
 #define KBBIND_H
 
-#include <QFile>
 #include <QHash>
 #include <QObject>
 #include <QProcess>
 #include "ckbsettings.h"
+#include "cmdfile.h"
 #include "keymap.h"
 #include "keyaction.h"
 
@@ -81,7 +81,7 @@ public:
 
     // Updates bindings to the driver. Write "mode %d" first.
     // By default, nothing will be written unless bindings have changed. Use force = true or call setNeedsUpdate() to override.
-    void        update(QFile& cmd, int notify, bool force = false);
+    void        update(CmdFile& cmd, int notify, bool force = false);
     inline void setNeedsUpdate()                        { _needsUpdate = true; }
 
     ////////
@@ -125,7 +125,7 @@ private:
     /// \brief lastCmd is a cache-hack.
     /// Because the QFile ist opened in Kb, and we need it in the macro processing functions,
     /// we cache the value her in lastCmd.
-    QFile*                           lastCmd;
+    CmdFile*                         lastCmd;
 
     KeyMap _map;
     // Key -> action map (no entry = default action)
@@ -0,0 +1,295 @@
+#include <cmath>
+#include "kbblend.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Blending functions
+
+static inline float blendNormal(float bg, float fg){
+    return fg;
+}
+
+static inline float blendAdd(float bg, float fg){
+    float res = bg + fg;
+    if(res > 1.f)
+        res = 1.f;
+    return res;
+}
+
+static inline float blendSubtract(float bg, float fg){
+    float res = bg - fg;
+    if(res < 0.f)
+        res = 0.f;
+    return res;
+}
+
+static inline float blendMultiply(float bg, float fg){
+    return bg * fg;
+}
+
+// Dividing by black gives white, including black / black. Both paths need to agree on this, as 0 / 0 is NaN
+static inline float blendDivide(float bg, float fg){
+    if(fg == 0.f)
+        return 1.f;
+    float res = bg / fg;
+    if(res > 1.f)
+        res = 1.f;
+    return res;
+}
+
+typedef float (*blendFunc)(float,float);
+static blendFunc functions[5] = { blendNormal, blendAdd, blendSubtract, blendMultiply, blendDivide };
+
+// Scalar versions, one key at a time
+
+static inline void blendScalar(QRgb& bg, QRgb fg, int mode, float fOpacity){
+    int alpha = qAlpha(fg);
+    if(alpha == 0)
+        return;
+    if(mode == 0){
+        // Blend: normal
+        // This is the most common use case and it requires much less arithmetic
+        if(alpha == 255){
+            bg = fg;
+        } else {
+            float r = qRed(bg), g = qGreen(bg), b = qBlue(bg);
+            float a = alpha * fOpacity;
+            r = r * (1.f - a) + qRed(fg) * a;
+            g = g * (1.f - a) + qGreen(fg) * a;
+            b = b * (1.f - a) + qBlue(fg) * a;
+            bg = qRgb(std::round(r), std::round(g), std::round(b));
+        }
+    } else {
+        // Use blend function
+        blendFunc blendF = functions[mode];
+        float r = qRed(bg) / 255.f, g = qGreen(bg) / 255.f, b = qBlue(bg) / 255.f;
+        float a = alpha * fOpacity;
+        r = r * (1.f - a) + blendF(r, qRed(fg) / 255.f) * a;
+        g = g * (1.f - a) + blendF(g, qGreen(fg) / 255.f) * a;
+        b = b * (1.f - a) + blendF(b, qBlue(fg) / 255.f) * a;
+        bg = qRgb(std::round(r * 255.f), std::round(g * 255.f), std::round(b * 255.f));
+    }
+}
+
+static inline void overlayScalar(QRgb& rgb, QRgb rgb2){
+    if(qAlpha(rgb2) == 0){
+        rgb = qRgb(qRed(rgb), qGreen(rgb), qBlue(rgb));
+        return;
+    }
+    float r = qRed(rgb), g = qGreen(rgb), b = qBlue(rgb);
+    float r2 = qRed(rgb2), g2 = qGreen(rgb2), b2 = qBlue(rgb2);
+    float a2 = qAlpha(rgb2) / 255.f;
+    r = std::round(r2 * a2 + r * (1.f - a2));
+    g = std::round(g2 * a2 + g * (1.f - a2));
+    b = std::round(b2 * a2 + b * (1.f - a2));
+    rgb = qRgb(r, g, b);
+}
+
+#ifdef __SSE2__
+
+// Four keys at a time, one channel per register
+
+struct Channels {
+    __m128 r, g, b;
+};
+
+static inline __m128 channel(__m128i rgb, int shift){
+    return _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(rgb, shift), _mm_set1_epi32(0xff)));
+}
+
+static inline Channels unpack(__m128i rgb){
+    return { channel(rgb, 16), channel(rgb, 8), channel(rgb, 0) };
+}
+
+// Same as std::round() for the non-negative values used here.
+// Adding 0.5 before truncating isn't exact for values just below x.5, so compare the fraction instead
+static inline __m128i roundChannel(__m128 x){
+    __m128i i = _mm_cvttps_epi32(x);
+    __m128 frac = _mm_sub_ps(x, _mm_cvtepi32_ps(i));
+    __m128i up = _mm_castps_si128(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)));
+    return _mm_and_si128(_mm_sub_epi32(i, up), _mm_set1_epi32(0xff));
+}
+
+// Equivalent of qRgb()
+static inline __m128i pack(__m128 r, __m128 g, __m128 b){
+    __m128i res = _mm_set1_epi32(0xff000000);
+    res = _mm_or_si128(res, _mm_slli_epi32(roundChannel(r), 16));
+    res = _mm_or_si128(res, _mm_slli_epi32(roundChannel(g), 8));
+    return _mm_or_si128(res, roundChannel(b));
+}
+
+static inline __m128i select(__m128i mask, __m128i a, __m128i b){
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+template<int Mode> static inline __m128 blendVector(__m128 bg, __m128 fg);
+template<> inline __m128 blendVector<0>(__m128 bg, __m128 fg){
+    return fg;
+}
+template<> inline __m128 blendVector<1>(__m128 bg, __m128 fg){
+    return _mm_min_ps(_mm_add_ps(bg, fg), _mm_set1_ps(1.f));
+}
+template<> inline __m128 blendVector<2>(__m128 bg, __m128 fg){
+    return _mm_max_ps(_mm_sub_ps(bg, fg), _mm_setzero_ps());
+}
+template<> inline __m128 blendVector<3>(__m128 bg, __m128 fg){
+    return _mm_mul_ps(bg, fg);
+}
+template<> inline __m128 blendVector<4>(__m128 bg, __m128 fg){
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 black = _mm_cmpeq_ps(fg, _mm_setzero_ps());
+    __m128 res = _mm_min_ps(_mm_div_ps(bg, fg), one);
+    return _mm_or_ps(_mm_and_ps(black, one), _mm_andnot_ps(black, res));
+}
+
+// bg * (1 - a) + blend(bg, fg) * a, in the [0, 1] range
+template<int Mode> static inline __m128 mixFunc(__m128 bg, __m128 fg, __m128 a, __m128 inva){
+    const __m128 scale = _mm_set1_ps(255.f);
+    bg = _mm_div_ps(bg, scale);
+    fg = _mm_div_ps(fg, scale);
+    __m128 res = _mm_add_ps(_mm_mul_ps(bg, inva), _mm_mul_ps(blendVector<Mode>(bg, fg), a));
+    return _mm_mul_ps(res, scale);
+}
+
+template<int Mode> static int blendSSE2(QRgb* bg, const QRgb* fg, int count, float fOpacity){
+    const __m128 opacity = _mm_set1_ps(fOpacity);
+    const __m128 one = _mm_set1_ps(1.f);
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        __m128i fgv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fg + i));
+        __m128i alpha = _mm_srli_epi32(fgv, 24);
+        __m128i transparent = _mm_cmpeq_epi32(alpha, _mm_setzero_si128());
+        if(_mm_movemask_epi8(transparent) == 0xffff)
+            continue;
+        __m128i bgv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg + i));
+        __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(alpha), opacity);
+        __m128 inva = _mm_sub_ps(one, a);
+        Channels b = unpack(bgv), f = unpack(fgv);
+        __m128i res;
+        if(Mode == 0){
+            res = pack(_mm_add_ps(_mm_mul_ps(b.r, inva), _mm_mul_ps(f.r, a)),
+                       _mm_add_ps(_mm_mul_ps(b.g, inva), _mm_mul_ps(f.g, a)),
+                       _mm_add_ps(_mm_mul_ps(b.b, inva), _mm_mul_ps(f.b, a)));
+            // Opaque keys are copied as-is
+            res = select(_mm_cmpeq_epi32(alpha, _mm_set1_epi32(255)), fgv, res);
+        } else {
+            res = pack(mixFunc<Mode>(b.r, f.r, a, inva), mixFunc<Mode>(b.g, f.g, a, inva), mixFunc<Mode>(b.b, f.b, a, inva));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bg + i), select(transparent, bgv, res));
+    }
+    return i;
+}
+
+static int overlaySSE2(QRgb* colors, const QRgb* overlay, int count){
+    const __m128 scale = _mm_set1_ps(255.f);
+    const __m128 one = _mm_set1_ps(1.f);
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        __m128i ov = _mm_loadu_si128(reinterpret_cast<const __m128i*>(overlay + i));
+        __m128i cv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+        // Alpha 0 leaves the color as it is, so those keys don't need to be masked out
+        __m128 a = _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(ov, 24)), scale);
+        __m128 inva = _mm_sub_ps(one, a);
+        Channels c = unpack(cv), o = unpack(ov);
+        __m128i res = pack(_mm_add_ps(_mm_mul_ps(o.r, a), _mm_mul_ps(c.r, inva)),
+                           _mm_add_ps(_mm_mul_ps(o.g, a), _mm_mul_ps(c.g, inva)),
+                           _mm_add_ps(_mm_mul_ps(o.b, a), _mm_mul_ps(c.b, inva)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(colors + i), res);
+    }
+    return i;
+}
+
+#endif // __SSE2__
+
+// Colorspace conversion: linear <-> sRGB, used for dimming and monochrome
+// (sRGB: [0, 255], linear: [0, 1])
+
+static float sToL(float srgb){
+    srgb /= 255.f;
+    if(srgb <= 0.04045f)
+        return srgb / 12.92f;
+    return std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
+static float lToS(float linear){
+    if(linear <= 0.0031308f)
+        return 12.92f * linear * 255.f;
+    return (1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f) * 255.f;
+}
+
+// The conversions above are too slow to run on every key of every frame, so they're done through lookup tables instead
+static const int LTOS_SIZE = 4096;
+
+static struct ColorTables {
+    // sRGB byte -> linear
+    float sToL[256];
+    // Linear [0, 1] -> rounded sRGB byte, accurate to +/-1
+    uchar lToS[LTOS_SIZE + 1];
+    // sRGB byte -> sRGB byte dimmed in linear space, for each dimming level
+    uchar dim[BLEND_MAX_DIM + 1][256];
+
+    ColorTables(){
+        for(int i = 0; i < 256; i++)
+            sToL[i] = ::sToL(i);
+        for(int i = 0; i <= LTOS_SIZE; i++)
+            lToS[i] = std::round(::lToS(i / (float)LTOS_SIZE));
+        for(int level = 0; level <= BLEND_MAX_DIM; level++){
+            float light = (BLEND_MAX_DIM - level) / (float)BLEND_MAX_DIM;
+            for(int i = 0; i < 256; i++)
+                dim[level][i] = std::round(::lToS(sToL[i] * light));
+        }
+    }
+} colorTables;
+
+float srgbToLinear(uchar srgb){
+    return colorTables.sToL[srgb];
+}
+
+uchar linearToSrgb(float linear){
+    return colorTables.lToS[(int)(qBound(0.f, linear, 1.f) * LTOS_SIZE + 0.5f)];
+}
+
+QRgb monoRgb(float r, float g, float b){
+    // It's important to use a linear colorspace for this, otherwise the colors will appear inconsistent
+    // Note that although we could use linear space for alpha blending or the animation blending functions, we don't.
+    // The reason for this is that photo manipulation programs don't do it either, so even though the result would technically be more correct,
+    // it would look wrong to most people.
+    float linear = (colorTables.sToL[(uchar)r] + colorTables.sToL[(uchar)g] + colorTables.sToL[(uchar)b]) / 3.f;
+    int value = colorTables.lToS[(int)(linear * LTOS_SIZE + 0.5f)];
+    return qRgb(value, value, value);
+}
+
+void dimColors(QRgb* colors, int count, int level){
+    // Like the monochrome conversion, this should be done in a linear colorspace
+    const uchar* dim = colorTables.dim[level];
+    for(int i = 0; i < count; i++){
+        QRgb& rgb = colors[i];
+        rgb = qRgb(dim[qRed(rgb)], dim[qGreen(rgb)], dim[qBlue(rgb)]);
+    }
+}
+
+void blendColors(QRgb* bg, const QRgb* fg, int count, int mode, double opacity){
+    float fOpacity = opacity / 255.f;  // save some math by pre-dividing the 255 for qAlpha
+    int i = 0;
+#ifdef __SSE2__
+    switch(mode){
+    case 0: i = blendSSE2<0>(bg, fg, count, fOpacity); break;
+    case 1: i = blendSSE2<1>(bg, fg, count, fOpacity); break;
+    case 2: i = blendSSE2<2>(bg, fg, count, fOpacity); break;
+    case 3: i = blendSSE2<3>(bg, fg, count, fOpacity); break;
+    case 4: i = blendSSE2<4>(bg, fg, count, fOpacity); break;
+    }
+#endif
+    for(; i < count; i++)
+        blendScalar(bg[i], fg[i], mode, fOpacity);
+}
+
+void overlayColors(QRgb* colors, const QRgb* overlay, int count){
+    int i = 0;
+#ifdef __SSE2__
+    i = overlaySSE2(colors, overlay, count);
+#endif
+    for(; i < count; i++)
+        overlayScalar(colors[i], overlay[i]);
+}
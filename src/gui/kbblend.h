@@ -0,0 +1,29 @@
+#ifndef KBBLEND_H
+#define KBBLEND_H
+
+#include <QRgb>
+
+// Per-frame color mixing kernels used by KbAnim and KbLight.
+// These work on whole ColorMap color arrays and use SSE2 when it's available. The results are identical to the plain
+// per-key float math, which is kept as the fallback and for the last few keys.
+
+// Blend fg over bg with one of the KbAnim::Mode blend modes. Keys with fg alpha 0 are left untouched.
+void blendColors(QRgb* bg, const QRgb* fg, int count, int mode, double opacity);
+
+// Alpha blend overlay on top of colors (used for indicators). The alpha channel of colors is set to opaque.
+void overlayColors(QRgb* colors, const QRgb* overlay, int count);
+
+// sRGB <-> linear colorspace conversion through lookup tables (sRGB: [0, 255], linear: [0, 1]).
+// These are accurate to +/-1 on the sRGB side.
+float srgbToLinear(uchar srgb);
+uchar linearToSrgb(float linear);
+
+// Convert RGB to monochrome, averaging the channels in linear space
+QRgb monoRgb(float r, float g, float b);
+
+// Number of dimming levels above 0, see KbLight::MAX_DIM
+static const int BLEND_MAX_DIM = 3;
+// Dim colors in linear space. level goes from 0 (unchanged) to BLEND_MAX_DIM (black)
+void dimColors(QRgb* colors, int count, int level);
+
+#endif // KBBLEND_H
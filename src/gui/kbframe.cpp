@@ -0,0 +1,107 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <QFile>
+#include "kbframe.h"
+
+KbFrame::KbFrame(const QString& path) :
+    _path(path), _frame(nullptr), _size(0), _openAttempts(0)
+{
+}
+
+KbFrame::~KbFrame(){
+    close();
+}
+
+bool KbFrame::open(){
+    if(_frame)
+        return true;
+    if(_openAttempts >= MAX_OPEN_ATTEMPTS)
+        return false;
+    _openAttempts++;
+    // The node is created asynchronously after "frame on", so it's normal for it not to exist yet
+    int fd = ::open(QFile::encodeName(_path).constData(), O_RDWR);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))){
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+        return false;
+    const Header* header = static_cast<const Header*>(map);
+    const size_t count = header->count;
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != FRAME_MAGIC
+            || sizeof(Header) + count * (FRAME_NAME_LEN + 3) > static_cast<size_t>(st.st_size)){
+        munmap(map, st.st_size);
+        return false;
+    }
+    _frame = static_cast<uchar*>(map);
+    _size = st.st_size;
+    // Read the key names so that colors can be placed by name
+    const char* names = reinterpret_cast<const char*>(_frame + sizeof(Header));
+    for(size_t i = 0; i < count; i++){
+        const char* name = names + i * FRAME_NAME_LEN;
+        if(name[0])
+            _names.insert(QByteArray(name, qstrnlen(name, FRAME_NAME_LEN)), i);
+    }
+    return true;
+}
+
+void KbFrame::close(){
+    if(_frame)
+        munmap(_frame, _size);
+    _frame = nullptr;
+    _size = 0;
+    _names.clear();
+    _indexNames.clear();
+    _index.clear();
+}
+
+void KbFrame::updateIndex(const ColorMap& colorMap){
+    const int mapCount = colorMap.count();
+    const char* const* names = colorMap.keyNames();
+    bool same = (_indexNames.count() == mapCount);
+    for(int i = 0; same && i < mapCount; i++)
+        same = (_indexNames.at(i) == names[i]);
+    if(same)
+        return;
+    _indexNames.resize(mapCount);
+    _index.resize(mapCount);
+    for(int i = 0; i < mapCount; i++){
+        _indexNames[i] = QByteArray(names[i]);
+        _index[i] = _names.value(_indexNames.at(i), -1);
+    }
+}
+
+bool KbFrame::write(const ColorMap& colorMap){
+    if(!open())
+        return false;
+    Header* header = reinterpret_cast<Header*>(_frame);
+    const size_t count = header->count;
+    uchar* r = _frame + sizeof(Header) + count * FRAME_NAME_LEN;
+    uchar* g = r + count;
+    uchar* b = g + count;
+    updateIndex(colorMap);
+    // The sequence number is odd while the frame is being written, so the daemon never applies half a frame
+    quint32 seq = header->seq;
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    const int mapCount = _index.count();
+    const QRgb* colors = colorMap.colors();
+    for(int i = 0; i < mapCount; i++){
+        int index = _index.at(i);
+        if(index < 0)
+            continue;
+        QRgb color = colors[i];
+        r[index] = qRed(color);
+        g[index] = qGreen(color);
+        b[index] = qBlue(color);
+    }
+    __atomic_store_n(&header->seq, seq + 2, __ATOMIC_RELEASE);
+    return true;
+}
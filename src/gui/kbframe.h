@@ -0,0 +1,53 @@
+#ifndef KBFRAME_H
+#define KBFRAME_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "colormap.h"
+
+// Shared frame node (<devpath>/frame) exported by the daemon after "frame on".
+// Colors are written straight into the mapped file and picked up by the daemon on "frame commit",
+// which avoids printing every key name and color to the cmd node on each frame.
+
+class KbFrame
+{
+public:
+    KbFrame(const QString& path);
+    ~KbFrame();
+
+    // Try to map the frame node. Gives up after a few failed attempts (e.g. if the daemon doesn't support it)
+    bool open();
+    void close();
+    inline bool isOpen() const { return _frame != nullptr; }
+
+    // Write a frame to the node. Returns false if nothing was written, in which case "rgb" should be used instead
+    bool write(const ColorMap& colorMap);
+
+private:
+    // Must match ckb_frame in the daemon's structures.h
+    struct Header {
+        quint32 magic;
+        quint32 count;
+        quint32 seq;
+        quint32 reserved;
+    };
+    static const quint32 FRAME_MAGIC = 0x314d5246;
+    static const int FRAME_NAME_LEN = 12;
+    static const int MAX_OPEN_ATTEMPTS = 60;
+
+    QString     _path;
+    uchar*      _frame;
+    size_t      _size;
+    int         _openAttempts;
+    // Key name -> frame index
+    QHash<QByteArray, int>  _names;
+    // ColorMap position -> frame index for the key list in _indexNames, rebuilt when a ColorMap has a different list
+    QVector<QByteArray>     _indexNames;
+    QVector<int>            _index;
+
+    void updateIndex(const ColorMap& colorMap);
+};
+
+#endif // KBFRAME_H
@@ -1,8 +1,10 @@
-#include <cmath>
 #include "monotonicclock.h"
 #include <QSet>
 #include "kblight.h"
+#include "kbblend.h"
+#include "kbmanager.h"
 #include "kbmode.h"
+#include "kbrenderer.h"
 #include <typeinfo>
 #include <ckbnextconfig.h>
 
@@ -233,7 +235,7 @@ void KbLight::close(){
     _start = false;
 }
 
-void KbLight::printRGB(QFile& cmd, const ColorMap &animMap){
+void KbLight::printRGB(CmdFile& cmd, const ColorMap &animMap){
     int count = animMap.count();
     const char* const* names = animMap.keyNames();
     const QRgb* colors = animMap.colors();
@@ -277,44 +279,60 @@ void KbLight::setIndicator(const char* name, QRgb argb){
     }
 }
 
-// Colorspace conversion: linear <-> sRGB
-// (sRGB: [0, 255], linear: [0, 1])
-
-static float sToL(float srgb){
-    srgb /= 255.f;
-    if(srgb <= 0.04045f)
-        return srgb / 12.92f;
-    return std::pow((srgb + 0.055f) / 1.055f, 2.4f);
-}
-
-static float lToS(float linear){
-    if(linear <= 0.0031308f)
-        return 12.92f * linear * 255.f;
-    return (1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f) * 255.f;
-}
-
-// Convert RGB to monochrome
-QRgb monoRgb(float r, float g, float b){
-    // It's important to use a linear colorspace for this, otherwise the colors will appear inconsistent
-    // Note that although we could use linear space for alpha blending or the animation blending functions, we don't.
-    // The reason for this is that photo manipulation programs don't do it either, so even though the result would technically be more correct,
-    // it would look wrong to most people.
-    r = sToL(r);
-    g = sToL(g);
-    b = sToL(b);
-    int value = std::round(lToS((r + g + b) / 3.f));
-    return qRgb(value, value, value);
-}
+static_assert(KbLight::MAX_DIM == BLEND_MAX_DIM, "The dimming tables in kbblend.cpp need one entry per dimming level");
 
 void KbLight::forceFrameUpdate(){
     _forceFrame = true;
 }
 
-void KbLight::frameUpdate(QFile& cmd, bool monochrome){
+void KbLight::frameUpdate(CmdFile& cmd, bool monochrome, KbRenderer* renderer, int mode){
     rebuildBaseMap();
+    quint64 timestamp = MonotonicClock::msecs();
+
+    // Leave the animations to the render thread if possible. In-process animations are advanced there, so they don't
+    // depend on this thread keeping up
+    if(renderer && renderer->isReady()){
+        KbRenderer::Frame frame;
+        frame.base = _colorMap;
+        frame.layers.reserve(_animList.count() + 1);
+        KbRenderer::Layer layer;
+        foreach(KbAnim* anim, _animList){
+            if(anim->layer(layer, timestamp))
+                frame.layers.append(layer);
+        }
+        if(_previewAnim && _previewAnim->layer(layer, timestamp))
+            frame.layers.append(layer);
+        frame.hasIndicators = !_indicatorList.isEmpty();
+        if(frame.hasIndicators)
+            frame.indicators = _indicatorMap;
+        frame.monochrome = monochrome;
+        frame.dimming = _dimming;
+        frame.mode = mode;
+        frame.force = _forceFrame;
+        frame.interval = KbManager::frameInterval();
+        if(renderer->submit(frame)){
+            _forceFrame = false;
+            // Emit signals for the GUI preview (only do this every 50ms - it can cause a lot of CPU usage)
+            if(timestamp >= lastFrameSignal + 50){
+                ColorMap rendered = renderer->lastFrame();
+                if(rendered.count() == _colorMap.count()){
+#ifdef FPS_COUNTER
+                    emit frameDisplayed(rendered, _indicatorList, timestamp - previousTimestamp);
+#else
+                    emit frameDisplayed(rendered, _indicatorList, 0);
+#endif
+                }
+                lastFrameSignal = timestamp;
+            }
+#ifdef FPS_COUNTER
+            previousTimestamp = timestamp;
+#endif
+            return;
+        }
+    }
+
     _animMap = _colorMap;
     // Advance animations
-    quint64 timestamp = MonotonicClock::msecs();
     foreach(KbAnim* anim, _animList)
         anim->blend(_animMap, timestamp);
     if(_previewAnim)
@@ -334,32 +352,9 @@ void KbLight::frameUpdate(QFile& cmd, bool monochrome){
 
     int count = _animMap.count();
     QRgb* colors = _animMap.colors();
+
     // Apply active indicators and/or perform monochrome conversion
-    if(monochrome || !_indicatorList.isEmpty()){
-        QRgb* indicators = _indicatorMap.colors();
-        for(int i = 0; i < count; i++){
-            QRgb& rgb = colors[i];
-            float r = qRed(rgb);
-            float g = qGreen(rgb);
-            float b = qBlue(rgb);
-            // Apply indicators
-            QRgb rgb2 = indicators[i];
-            if(qAlpha(rgb2) != 0){
-                float r2 = qRed(rgb2);
-                float g2 = qGreen(rgb2);
-                float b2 = qBlue(rgb2);
-                float a2 = qAlpha(rgb2) / 255.f;
-                r = std::round(r2 * a2 + r * (1.f - a2));
-                g = std::round(g2 * a2 + g * (1.f - a2));
-                b = std::round(b2 * a2 + b * (1.f - a2));
-            }
-            // If monochrome mode is active, average the channels to get a grayscale image
-            if(monochrome)
-                rgb = monoRgb(r, g, b);
-            else
-                rgb = qRgb(r, g, b);
-        }
-    }
+    applyIndicators(colors, _indicatorList.isEmpty() ? nullptr : _indicatorMap.colors(), count, monochrome);
 
     // Emit signals for the GUI preview (only do this every 50ms - it can cause a lot of CPU usage)
     if(timestamp >= lastFrameSignal + 50){
@@ -380,24 +375,8 @@ void KbLight::frameUpdate(QFile& cmd, bool monochrome){
         return;
     }
 
-    float light = (3 - _dimming) / 3.f;
     // Apply global dimming
-    if(light != 1.f || monochrome){
-        for(int i = 0; i < count; i++){
-            QRgb& rgb = colors[i];
-            // Like the monochrome conversion, this should be done in a linear colorspace
-            float r = sToL(qRed(rgb));
-            float g = sToL(qGreen(rgb));
-            float b = sToL(qBlue(rgb));
-            r *= light;
-            g *= light;
-            b *= light;
-            r = std::round(lToS(r));
-            g = std::round(lToS(g));
-            b = std::round(lToS(b));
-            rgb = qRgb(r, g, b);
-        }
-    }
+    applyDimming(colors, count, _dimming, monochrome);
 
     // Apply light
     cmd.write("rgb");
@@ -405,7 +384,26 @@ void KbLight::frameUpdate(QFile& cmd, bool monochrome){
     cmd.write("\n");
 }
 
-void KbLight::base(QFile &cmd, bool ignoreDim, bool monochrome){
+void KbLight::applyIndicators(QRgb* colors, const QRgb* indicators, int count, bool monochrome){
+    // Apply active indicators
+    if(indicators)
+        overlayColors(colors, indicators, count);
+    // If monochrome mode is active, average the channels to get a grayscale image
+    if(monochrome){
+        for(int i = 0; i < count; i++){
+            QRgb& rgb = colors[i];
+            rgb = monoRgb(qRed(rgb), qGreen(rgb), qBlue(rgb));
+        }
+    }
+}
+
+void KbLight::applyDimming(QRgb* colors, int count, int dimming, bool monochrome){
+    if(dimming == 0 && !monochrome)
+        return;
+    dimColors(colors, count, qBound(0, dimming, (int)MAX_DIM));
+}
+
+void KbLight::base(CmdFile &cmd, bool ignoreDim, bool monochrome){
     close();
     if(_dimming == MAX_DIM && !ignoreDim){
         cmd.write("rgb 000000");
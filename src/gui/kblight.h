@@ -1,10 +1,10 @@
 #ifndef KBLIGHT_H
 #define KBLIGHT_H
 
-#include <QFile>
 #include <QObject>
 #include <QSet>
 #include <QSettings>
+#include "cmdfile.h"
 #include "animscript.h"
 #include "kbanim.h"
 #include "keymap.h"
@@ -12,6 +12,7 @@
 #include <ckbnextconfig.h>
 
 class KbMode;
+class KbRenderer;
 
 // Keyboard lighting setup
 
@@ -72,9 +73,14 @@ public:
     void setIndicator(const char* name, QRgb argb);
 
     // Write a new frame to the keyboard. Write "mode %d" first. Optionally provide a list of keys to use as indicators and overwrite the lighting
-    void frameUpdate(QFile& cmd, bool monochrome = false);
+    // If a render thread is given, the base colors and animations are handed over to it for the given hardware mode, and it blends
+    // and sends the frames. Nothing is sent through cmd then
+    void frameUpdate(CmdFile& cmd, bool monochrome = false, KbRenderer* renderer = nullptr, int mode = 0);
+    // Frame post-processing. Indicators may be null
+    static void applyIndicators(QRgb* colors, const QRgb* indicators, int count, bool monochrome);
+    static void applyDimming(QRgb* colors, int count, int dimming, bool monochrome);
     // Write the mode's base colors without any animation
-    void base(QFile& cmd, bool ignoreDim = false, bool monochrome = false);
+    void base(CmdFile& cmd, bool ignoreDim = false, bool monochrome = false);
 
     // Load and save from stored settings
     void load(CkbSettingsBase& settings);
@@ -108,7 +114,7 @@ private:
     // Rebuild base ColorMap (if needed)
     void rebuildBaseMap();
     // Print RGB values to cmd node
-    void printRGB(QFile& cmd, const ColorMap& animMap);
+    void printRGB(CmdFile& cmd, const ColorMap& animMap);
 #ifdef FPS_COUNTER
     quint64 previousTimestamp;
 #endif
@@ -1,6 +1,14 @@
 #include "kbmanager.h"
 #include "idletimer.h"
+#include "monotonicclock.h"
+#include <QDebug>
+#include <cstring>
 #include <limits>
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 #ifndef Q_OS_MACOS
 QString devpath = "/dev/input/ckb%1";
@@ -16,6 +24,7 @@ QString devpath = "/var/run/ckb%1";
 
 CkbVersionNumber KbManager::_guiVersion, KbManager::_daemonVersion;
 KbManager* KbManager::_kbManager = nullptr;
+bool KbManager::_frameStats = false;
 
 #ifdef USE_XCB_SCREENSAVER
 QTimer* KbManager::_idleTimer = nullptr;
@@ -87,16 +96,116 @@ void KbManager::stop(){
     _kbManager = nullptr;
 }
 
-KbManager::KbManager(QObject *parent) : QObject(parent){
+KbManager::KbManager(QObject *parent) : QObject(parent), _frameInterval(0), _nextFrame(0),
+#ifdef Q_OS_LINUX
+    _inotifyFd(-1), _parentWatch(-1), _rootWatch(-1), _inotifyNotifier(nullptr),
+#endif
+    _scanOnTimer(true), _openFailed(false), _scanTicks(0){
     // Set up the timers
     _eventTimer = new QTimer(this);
     _eventTimer->setTimerType(Qt::PreciseTimer);
+    _eventTimer->setSingleShot(true);
+    // Connected before any device, so the next frame is scheduled before this one is rendered
+    connect(_eventTimer, &QTimer::timeout, this, &KbManager::eventTimerTick);
+    memset(_frameHistogram, 0, sizeof(_frameHistogram));
+    _lastFrame = _lastFrameReport = 0;
+    _skippedFrames = 0;
     _saveTimer = new QTimer(this);
     _saveTimer->start(30 * 1000);
     _scanTimer = new QTimer(this);
     _scanTimer->start(1000);
-    connect(_scanTimer, &QTimer::timeout, this, &KbManager::scanKeyboards);
+    connect(_scanTimer, &QTimer::timeout, this, [this]{
+        // Even with inotify, rescan every tick while a listed device couldn't be opened, and every few ticks otherwise
+        // in case an event was missed
+        if(_scanOnTimer || _openFailed || ++_scanTicks >= FALLBACK_SCAN_TICKS)
+            scanKeyboards();
+    });
+    watchDevnodes();
+}
+
+KbManager::~KbManager(){
+#ifdef Q_OS_LINUX
+    if(_inotifyFd != -1)
+        close(_inotifyFd);
+#endif
+}
+
+void KbManager::watchDevnodes(){
+#ifdef Q_OS_LINUX
+    _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(_inotifyFd == -1){
+        qWarning() << "inotify unavailable, scanning for devices every second:" << strerror(errno);
+        return;
+    }
+    // The root node (ckb0) is created and removed by the daemon, so watch its parent for that
+    const QString rootdev = devpath.arg(0);
+    const QByteArray parent = rootdev.section('/', 0, -2).toLocal8Bit();
+    _parentWatch = inotify_add_watch(_inotifyFd, parent.constData(), IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+    if(_parentWatch == -1){
+        qWarning() << "Unable to watch" << parent << "for the ckb-next daemon, scanning for devices every second:" << strerror(errno);
+        close(_inotifyFd);
+        _inotifyFd = -1;
+        return;
+    }
+    _inotifyNotifier = new QSocketNotifier(_inotifyFd, QSocketNotifier::Read, this);
+    connect(_inotifyNotifier, &QSocketNotifier::activated, this, &KbManager::inotifyEvent);
+    // The root may not exist yet. It's picked up by the parent watch once the daemon starts
+    watchRoot();
+    _scanOnTimer = false;
+#endif
+}
+
+#ifdef Q_OS_LINUX
+bool KbManager::watchRoot(){
+    if(_rootWatch != -1)
+        return true;
+    // The daemon rewrites the connected list (and writes the version) in place every time a device is added or removed
+    const QByteArray rootdev = devpath.arg(0).toLocal8Bit();
+    _rootWatch = inotify_add_watch(_inotifyFd, rootdev.constData(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR);
+    return _rootWatch != -1;
+}
+
+void KbManager::inotifyEvent(){
+    const QString rootname = devpath.arg(0).section('/', -1);
+    bool rescan = false;
+    // Drain every queued event before scanning, so that a burst (e.g. several devices plugged in at once) is handled with a single scan
+    alignas(inotify_event) char buffer[4096];
+    ssize_t len;
+    while((len = read(_inotifyFd, buffer, sizeof(buffer))) > 0){
+        for(char* ptr = buffer; ptr < buffer + len; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len){
+            const inotify_event* event = reinterpret_cast<inotify_event*>(ptr);
+            if(event->mask & IN_Q_OVERFLOW){
+                // Lost track of what happened, start over
+                if(_rootWatch != -1)
+                    inotify_rm_watch(_inotifyFd, _rootWatch);
+                _rootWatch = -1;
+                watchRoot();
+                rescan = true;
+            } else if(event->wd == _parentWatch){
+                if(!event->len || QString::fromLocal8Bit(event->name) != rootname)
+                    continue;
+                if(event->mask & (IN_CREATE | IN_MOVED_TO))
+                    watchRoot();
+                rescan = true;
+            } else if(event->wd == _rootWatch){
+                if(event->mask & (IN_DELETE_SELF | IN_IGNORED))
+                    _rootWatch = -1;
+                else if(!event->len || strcmp(event->name, "connected"))
+                    continue;
+                rescan = true;
+            }
+        }
+    }
+    if(len == -1 && errno != EAGAIN){
+        // Shouldn't happen, but don't leave the device list stale if it does
+        qWarning() << "Unable to read inotify events, scanning for devices every second:" << strerror(errno);
+        _inotifyNotifier->setEnabled(false);
+        _scanOnTimer = true;
+    }
+    if(rescan)
+        scanKeyboards();
 }
+#endif
 
 int KbManager::getLastUsedDeviceIdleTime(){
     qint64 last = std::numeric_limits<qint64>::max();
@@ -113,19 +222,60 @@ int KbManager::getLastUsedDeviceIdleTime(){
 }
 
 void KbManager::fps(int framerate){
-    QTimer* timer = eventTimer();
-    if(!timer)
+    if(!_kbManager || framerate <= 0)
         return;
-    // Explicitly round the result to the nearest integer
-    // If we strip the decimal part, then we end up with 62.5 FPS instead of 60
-    const int target = roundf(1000.f / framerate);
-    if(timer->isActive())
-        timer->setInterval(target);
-    else
-        timer->start(target);
+    // Use the exact interval instead of rounding it to milliseconds, otherwise 60 FPS would turn into 62.5 FPS.
+    // This also keeps the GUI in step with the daemon, which is sent the same frame rate.
+    const qint64 interval = 1000000000LL / framerate;
+    if(interval == _kbManager->_frameInterval && _kbManager->_eventTimer->isActive())
+        return;
+    _kbManager->_frameInterval = interval;
+    const qint64 now = MonotonicClock::nsecs();
+    _kbManager->_nextFrame = now + interval;
+    _kbManager->armEventTimer(now);
+}
+
+void KbManager::armEventTimer(qint64 now){
+    // QTimer only has millisecond resolution. Round down and let the next deadline make up for it
+    qint64 delay = (_nextFrame - now) / 1000000;
+    _eventTimer->start(delay < 0 ? 0 : static_cast<int>(delay));
+}
+
+void KbManager::eventTimerTick(){
+    const qint64 now = MonotonicClock::nsecs();
+    if(_frameStats){
+        if(_lastFrame){
+            qint64 bucket = (now - _lastFrame) / 1000000;
+            _frameHistogram[bucket < FRAME_HISTOGRAM_SIZE - 1 ? bucket : FRAME_HISTOGRAM_SIZE - 1]++;
+        }
+        _lastFrame = now;
+    }
+    // Schedule the next frame on the fixed grid. If we're more than a frame late (e.g. the GUI was busy),
+    // skip the missed frames instead of trying to catch up with a burst
+    _nextFrame += _frameInterval;
+    if(_nextFrame <= now){
+        qint64 missed = (now - _nextFrame) / _frameInterval + 1;
+        _nextFrame += missed * _frameInterval;
+        _skippedFrames += missed;
+    }
+    armEventTimer(now);
+    // Print the frame interval histogram every 10s
+    if(_frameStats && now - _lastFrameReport >= 10000000000LL){
+        QString report;
+        for(int i = 0; i < FRAME_HISTOGRAM_SIZE; i++){
+            if(_frameHistogram[i])
+                report += QString(" %1%2ms:%3").arg(i == FRAME_HISTOGRAM_SIZE - 1 ? ">=" : "").arg(i).arg(_frameHistogram[i]);
+        }
+        qDebug() << "Frame intervals" << (1000000000. / _frameInterval) << "FPS target," << _skippedFrames << "skipped:" << report.toLatin1().constData();
+        memset(_frameHistogram, 0, sizeof(_frameHistogram));
+        _skippedFrames = 0;
+        _lastFrameReport = now;
+    }
 }
 
 void KbManager::scanKeyboards(){
+    _scanTicks = 0;
+    _openFailed = false;
     QString rootdev = devpath.arg(0);
     QFile connected(rootdev + "/connected");
     if(!connected.open(QIODevice::ReadOnly)){
@@ -200,7 +350,9 @@ void KbManager::scanKeyboards(){
         // Device not found, create new
         Kb* kb = new Kb(this, line[0]);
         if(!kb->isOpen()){
+            // Try again on the next _scanTimer tick
             delete kb;
+            _openFailed = true;
             continue;
         }
         _devices.insert(kb);
@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QTimer>
+#include <QSocketNotifier>
 #include <cmath>
 #include <QSet>
 #include "kb.h"
@@ -30,11 +31,18 @@ public:
 
     // Event timer for the driver. Created during init(). Starts ticking when fps() is called.
     // Use this for animations or other events which need to run at a high frame rate.
+    // The timer is single-shot and re-armed on every tick, so that frames follow fixed deadlines and don't drift.
     static inline QTimer* eventTimer()      { return _kbManager ? _kbManager->_eventTimer : nullptr; }
     // Sets the frame rate for the event timer
     static void fps(int framerate);
-
-    // Timer for scanning the driver/device list. May also be useful for periodic GUI events. Created during init(), always runs at 10FPS.
+    // Time between frames in ns, 0 until fps() is called
+    static inline qint64 frameInterval()    { return _kbManager ? _kbManager->_frameInterval : 0; }
+    // Logs a histogram of the actual frame intervals every 10 seconds (--frame-stats)
+    static inline void setFrameStats(bool enable)   { _frameStats = enable; }
+
+    // Timer for periodic GUI events. Created during init(), always runs at 1FPS.
+    // Rescans the device list on every tick when the devnode root can't be watched with inotify (see watchDevnodes()),
+    // or while a listed device couldn't be opened. Otherwise only every FALLBACK_SCAN_TICKS ticks.
     static inline QTimer* scanTimer()       { return _kbManager ? _kbManager->_scanTimer : nullptr; }
     inline bool getDeviceTimerDimmed() { for(Kb* kb : _devices) if(kb->currentLight()->isTimerDimmed()) { return true; } return false; }
 
@@ -60,15 +68,45 @@ private slots:
 #ifdef USE_XCB_SCREENSAVER
     void idleTimerTick();
 #endif
+    void eventTimerTick();
+#ifdef Q_OS_LINUX
+    void inotifyEvent();
+#endif
 
 private:
     static KbManager* _kbManager;
     static CkbVersionNumber _guiVersion, _daemonVersion;
 
     explicit KbManager(QObject* parent = nullptr);
+    ~KbManager();
 
     QSet<Kb*> _devices;
     QTimer* _eventTimer, *_scanTimer, *_saveTimer;
+    // Frame interval and deadline of the next frame (monotonic, ns)
+    qint64 _frameInterval, _nextFrame;
+    // Histogram of actual frame intervals (1ms buckets, the last one counts everything above).
+    // Only collected when frame stats are enabled
+    static bool _frameStats;
+    static const int FRAME_HISTOGRAM_SIZE = 64;
+    quint32 _frameHistogram[FRAME_HISTOGRAM_SIZE];
+    qint64 _lastFrame, _lastFrameReport;
+    quint32 _skippedFrames;
+    void armEventTimer(qint64 now);
+#ifdef Q_OS_LINUX
+    // inotify watches on the parent of the devnode root (for the daemon starting/stopping) and on the root itself
+    // (for the connected list being rewritten). -1 when not watched.
+    int _inotifyFd, _parentWatch, _rootWatch;
+    QSocketNotifier* _inotifyNotifier;
+    bool watchRoot();
+#endif
+    // Sets up event-driven device discovery. Falls back to scanning on every _scanTimer tick if it isn't available.
+    void watchDevnodes();
+    bool _scanOnTimer;
+    // Set by scanKeyboards() when a device in the connected list failed to open
+    bool _openFailed;
+    // _scanTimer ticks since the last scan, and how many to wait for when inotify is active
+    int _scanTicks;
+    static const int FALLBACK_SCAN_TICKS = 10;
 #ifdef USE_XCB_SCREENSAVER
     static QTimer* _idleTimer;
 #endif
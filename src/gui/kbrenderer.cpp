@@ -0,0 +1,130 @@
+#include "kbblend.h"
+#include "kblight.h"
+#include "kbrenderer.h"
+#include "monotonicclock.h"
+
+KbRenderer::KbRenderer(const QString& framePath) :
+    _frame(framePath), _cmd(nullptr), _pending(false), _stop(false)
+{
+}
+
+KbRenderer::~KbRenderer(){
+    stop();
+}
+
+void KbRenderer::start(CmdFile* cmd){
+    if(isRunning())
+        return;
+    _cmd = cmd;
+    _stop = false;
+    QThread::start();
+}
+
+void KbRenderer::stop(){
+    {
+        QMutexLocker locker(&_mutex);
+        _stop = true;
+        _pending = false;
+        // Let go of the animations
+        _next.layers.clear();
+        _cond.wakeAll();
+    }
+    wait();
+    _frame.close();
+}
+
+bool KbRenderer::isReady(){
+    QMutexLocker locker(&_mutex);
+    return isRunning() && !_stop && _frame.open();
+}
+
+bool KbRenderer::submit(const Frame& frame){
+    QMutexLocker locker(&_mutex);
+    if(!isRunning() || _stop || !_frame.open())
+        return false;
+    // Replace the previous frame. A forced frame stays forced until it's been sent
+    const bool force = _pending && _next.force;
+    _next = frame;
+    _next.force |= force;
+    _pending = true;
+    _cond.wakeOne();
+    return true;
+}
+
+ColorMap KbRenderer::lastFrame(){
+    QMutexLocker locker(&_mutex);
+    return _output;
+}
+
+void KbRenderer::run(){
+    Frame frame;
+    ColorMap last;
+    bool animated = false, dirty = false;
+    qint64 nextFrame = 0;
+    QMutexLocker locker(&_mutex);
+    while(!_stop){
+        if(_pending){
+            frame = _next;
+            _pending = false;
+            dirty = true;
+            animated = false;
+            foreach(const Layer& layer, frame.layers){
+                if(layer.plugin)
+                    animated = true;
+            }
+            animated = animated && frame.interval > 0;
+        }
+        if(animated){
+            // Keep the frame rate on our own clock, the GUI thread only hands over changes.
+            // Like KbManager, skip missed frames instead of catching up with a burst
+            const qint64 now = MonotonicClock::nsecs();
+            if(now < nextFrame){
+                _cond.wait(&_mutex, (nextFrame - now + 999999) / 1000000);
+                continue;
+            }
+            nextFrame += frame.interval;
+            if(nextFrame <= now)
+                nextFrame = now + frame.interval;
+        } else if(!dirty){
+            _cond.wait(&_mutex);
+            continue;
+        }
+        dirty = false;
+        locker.unlock();
+
+        render(frame, last);
+
+        locker.relock();
+    }
+}
+
+void KbRenderer::render(Frame& frame, ColorMap& last){
+    const quint64 timestamp = MonotonicClock::msecs();
+    ColorMap colors = frame.base;
+    const int count = colors.count();
+    for(int i = 0; i < frame.layers.count(); i++){
+        Layer& layer = frame.layers[i];
+        if(layer.colors.count() != count)
+            continue;
+        if(layer.plugin)
+            layer.plugin->frame(timestamp, layer.colors.colors(), layer.index);
+        blendColors(colors.colors(), layer.colors.colors(), count, layer.mode, layer.opacity);
+    }
+    const bool hasIndicators = frame.hasIndicators && frame.indicators.count() == count;
+    KbLight::applyIndicators(colors.colors(), hasIndicators ? frame.indicators.colors() : nullptr, count, frame.monochrome);
+    {
+        QMutexLocker locker(&_mutex);
+        _output = colors;
+    }
+    KbLight::applyDimming(colors.colors(), count, frame.dimming, frame.monochrome);
+
+    // Nothing to do if the frame hasn't changed
+    if(colors == last && !frame.force)
+        return;
+    // The GUI thread writes to the same node, CmdFile keeps the commit from landing in the middle of its commands.
+    // If the daemon isn't keeping up the commit is dropped, and the frame is sent again next time.
+    if(_frame.write(colors) && _cmd->writeLine(QString("mode %1 frame commit\n").arg(frame.mode + 1).toLatin1())){
+        last = colors;
+        frame.force = false;
+    }
+}
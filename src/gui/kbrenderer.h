@@ -0,0 +1,80 @@
+#ifndef KBRENDERER_H
+#define KBRENDERER_H
+
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include "animplugin.h"
+#include "cmdfile.h"
+#include "colormap.h"
+#include "kbframe.h"
+
+// Per-device render thread. KbLight hands over the mode's base colors and animation layers, and the thread blends
+// them, applies indicators, monochrome conversion and dimming, writes the result to the shared frame node and commits it.
+// Animations that run in-process are advanced here at the frame rate, so they keep going while the GUI thread is busy.
+// Animation processes are still read through the GUI's event loop, so their layers show the frame they last delivered.
+
+class KbRenderer : public QThread
+{
+    Q_OBJECT
+public:
+    // One animation, blended over the frame in order
+    struct Layer {
+        // The animation's last frame
+        ColorMap                    colors;
+        // If set, the animation is advanced here and each frame is drawn into colors at index
+        QSharedPointer<AnimPlugin>  plugin;
+        QVector<int>                index;
+        int                         mode;
+        float                       opacity;
+
+        Layer() : mode(0), opacity(1.f) {}
+    };
+    struct Frame {
+        ColorMap        base, indicators;
+        QVector<Layer>  layers;
+        bool            hasIndicators, monochrome;
+        int             dimming;
+        // Hardware mode (0-based)
+        int             mode;
+        // Send the frame even if it hasn't changed
+        bool            force;
+        // Time between frames in ns, while any layer is animated here
+        qint64          interval;
+
+        Frame() : hasIndicators(false), monochrome(false), dimming(0), mode(0), force(false), interval(0) {}
+    };
+
+    KbRenderer(const QString& framePath);
+    ~KbRenderer();
+
+    // Start rendering. Commits are written to the cmd node, which has to stay open until stop()
+    void start(CmdFile* cmd);
+    // Stop the thread and unmap the frame node
+    void stop();
+
+    // Whether the frame node is available. If not, frames must be sent through cmd instead.
+    bool isReady();
+    // Replace the frame to render. Returns false if the frame node isn't available.
+    bool submit(const Frame& frame);
+    // The last frame rendered, before dimming. Empty if nothing has been rendered yet
+    ColorMap lastFrame();
+
+private:
+    KbFrame         _frame;
+    CmdFile*        _cmd;
+    QMutex          _mutex;
+    QWaitCondition  _cond;
+    bool            _pending, _stop;
+
+    // Protected by the mutex
+    Frame           _next;
+    ColorMap        _output;
+
+    void run();
+    void render(Frame& frame, ColorMap& last);
+};
+
+#endif // KBRENDERER_H
@@ -6,6 +6,7 @@
 #include "keywidget.h"
 #include "keyaction.h"
 #include "kbbind.h"
+#include "kbblend.h"
 #include <QToolTip>
 #include <limits>
 #include <QLabel>
@@ -35,9 +36,6 @@ static const QColor yellow(255, 248, 128);
 static const QBrush hitboxBrush(QColor(255, 136, 136, 128));
 #endif
 
-// KbLight.cpp
-extern QRgb monoRgb(float r, float g, float b);
-
 static const QMap<QString, QString> keyNames {
     {"light", "☼"}, {"lock", "☒"}, {"mute", "🔇"}, {"volup", "▲"}, {"voldn", "▼"},
     {"prtscn",  "PrtScn\nSysRq"}, {"scroll", "Scroll\nLock"}, {"pause", "Pause\nBreak"}, {"stop", "■"}, {"prev", "⏮"}, {"play", "⏯"}, {"next", "⏭"},
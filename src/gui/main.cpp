@@ -12,6 +12,7 @@
 #include "compat/qrand.h"
 #include <QMessageBox>
 #include "keywidgetdebugger.h"
+#include "kbmanager.h"
 #include <QSurfaceFormat>
 #include <iostream>
 
@@ -41,6 +42,7 @@ enum CommandLineParseResults {
 
 bool startDelay = false;
 bool silent = false;
+bool frameStats = false;
 #ifndef QT_NO_DEBUG
 bool kwdebug = false;
 #endif
@@ -92,6 +94,9 @@ CommandLineParseResults parseCommandLine(QCommandLineParser &parser, QString *er
     parser.addOption(delayOption);
     parser.addOption(silentOption);
 
+    QCommandLineOption frameStatsOption("frame-stats", QObject::tr("Logs a histogram of the lighting frame intervals every 10 seconds"));
+    parser.addOption(frameStatsOption);
+
 #ifndef QT_NO_DEBUG
     QCommandLineOption kwdebugOption("kwdebug", QObject::tr("Enables the KeyWidget debug window"));
     parser.addOption(kwdebugOption);
@@ -123,6 +128,10 @@ CommandLineParseResults parseCommandLine(QCommandLineParser &parser, QString *er
         silent = true;
     }
 
+    if(parser.isSet(frameStatsOption)) {
+        frameStats = true;
+    }
+
 #ifndef QT_NO_DEBUG
     if(parser.isSet(kwdebugOption)) {
         kwdebug = true;
@@ -396,6 +405,7 @@ QSettings::setDefaultFormat(CkbSettings::Format);
 
     std::cout << "ckb-next " << CKB_NEXT_VERSION_STR << std::endl;
 
+    KbManager::setFrameStats(frameStats);
     MainWindow w(silent);
     if(!background)
         w.show();
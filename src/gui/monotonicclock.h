@@ -10,6 +10,9 @@ struct MonotonicClock {
         milliseconds ms = duration_cast<milliseconds>(tp.time_since_epoch());
         return ms.count();
     }
+    static inline qint64 nsecs() {
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
 };
 
 #endif // MONOTONICCLOCK_H
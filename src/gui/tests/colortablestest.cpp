@@ -0,0 +1,80 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "kbblend.h"
+
+// Checks the sRGB <-> linear lookup tables in kbblend.cpp against the exact conversions they replace.
+// Everything on the sRGB side has to be within +/-1.
+
+static int failures = 0;
+
+// The exact conversions, in double precision
+static double sToL(double srgb){
+    srgb /= 255.;
+    if(srgb <= 0.04045)
+        return srgb / 12.92;
+    return std::pow((srgb + 0.055) / 1.055, 2.4);
+}
+
+static double lToS(double linear){
+    if(linear <= 0.0031308)
+        return 12.92 * linear * 255.;
+    return (1.055 * std::pow(linear, 1. / 2.4) - 0.055) * 255.;
+}
+
+static void check(const char* what, int input, int value, double expected){
+    if(std::abs(value - expected) <= 1.)
+        return;
+    if(failures++ < 20)
+        printf("%s(%d) = %d, expected %.2f\n", what, input, value, expected);
+}
+
+int main(){
+    // sRGB -> linear. The table has to convert back to the same byte
+    double linear[256];
+    for(int i = 0; i < 256; i++){
+        linear[i] = sToL(i);
+        check("srgbToLinear", i, std::lround(lToS(srgbToLinear(i))), i);
+        if(std::abs(srgbToLinear(i) - linear[i]) > 1e-6 && failures++ < 20)
+            printf("srgbToLinear(%d) = %f, expected %f\n", i, srgbToLinear(i), linear[i]);
+    }
+
+    // Linear -> sRGB, much finer than the table
+    const int steps = 1 << 16;
+    for(int i = 0; i <= steps; i++)
+        check("linearToSrgb", i, linearToSrgb(i / (float)steps), lToS(i / (double)steps));
+
+    // Monochrome, for every color
+    for(int r = 0; r < 256; r++){
+        for(int g = 0; g < 256; g++){
+            for(int b = 0; b < 256; b++){
+                QRgb mono = monoRgb(r, g, b);
+                double expected = lToS((linear[r] + linear[g] + linear[b]) / 3.);
+                if(qRed(mono) != qGreen(mono) || qRed(mono) != qBlue(mono) || qAlpha(mono) != 255){
+                    if(failures++ < 20)
+                        printf("monoRgb(%d, %d, %d) = %08x isn't an opaque gray\n", r, g, b, mono);
+                    continue;
+                }
+                check("monoRgb", (r << 16) | (g << 8) | b, qRed(mono), expected);
+            }
+        }
+    }
+
+    // Every entry of every dimming table
+    for(int level = 0; level <= BLEND_MAX_DIM; level++){
+        QRgb colors[256];
+        for(int i = 0; i < 256; i++)
+            colors[i] = qRgb(i, i, i);
+        dimColors(colors, 256, level);
+        double light = (BLEND_MAX_DIM - level) / (double)BLEND_MAX_DIM;
+        for(int i = 0; i < 256; i++)
+            check(level ? "dimColors" : "dimColors (level 0)", i, qRed(colors[i]), lToS(linear[i] * light));
+    }
+
+    if(failures){
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("Color tables match the exact conversions\n");
+    return 0;
+}
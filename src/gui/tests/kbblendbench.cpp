@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "kbblend.h"
+
+// Times the kernels in kbblend.cpp the way KbLight and KbRenderer use them for one frame: a stack of animation layers
+// blended over the base colors of a full keyboard, then indicators and dimming.
+// The scalar numbers come from running the kernels one key at a time, which never reaches the vector code (see
+// kbblendtest.cpp), so they include a function call per key.
+//
+// Usage: ckb-next-blend-bench [-n <frames>]
+
+static const int KEYS = 150;
+static const int LAYERS = 8;
+
+static double nsecs(){
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static QRgb randomColor(){
+    return qRgba(rand() % 256, rand() % 256, rand() % 256, rand() % 256);
+}
+
+// Returns ns per frame. The checksum keeps the work from being optimized out and has to match between both versions.
+static double blendFrames(int frames, int mode, bool scalar, const std::vector<QRgb>& base,
+                          const std::vector<std::vector<QRgb>>& layers, unsigned& checksum){
+    std::vector<QRgb> colors(KEYS);
+    double start = nsecs();
+    for(int frame = 0; frame < frames; frame++){
+        memcpy(colors.data(), base.data(), KEYS * sizeof(QRgb));
+        for(int layer = 0; layer < LAYERS; layer++){
+            const double opacity = (layer % 2) ? 0.6 : 1.0;
+            if(scalar){
+                for(int i = 0; i < KEYS; i++)
+                    blendColors(&colors[i], &layers[layer][i], 1, mode, opacity);
+            } else
+                blendColors(colors.data(), layers[layer].data(), KEYS, mode, opacity);
+        }
+    }
+    double time = nsecs() - start;
+    for(int i = 0; i < KEYS; i++)
+        checksum = checksum * 31 + colors[i];
+    return time / frames;
+}
+
+static double postFrames(int frames, bool scalar, const std::vector<QRgb>& base, const std::vector<QRgb>& indicators,
+                         unsigned& checksum){
+    std::vector<QRgb> colors(KEYS);
+    double start = nsecs();
+    for(int frame = 0; frame < frames; frame++){
+        memcpy(colors.data(), base.data(), KEYS * sizeof(QRgb));
+        if(scalar){
+            for(int i = 0; i < KEYS; i++){
+                overlayColors(&colors[i], &indicators[i], 1);
+                dimColors(&colors[i], 1, 1);
+            }
+        } else {
+            overlayColors(colors.data(), indicators.data(), KEYS);
+            dimColors(colors.data(), KEYS, 1);
+        }
+    }
+    double time = nsecs() - start;
+    for(int i = 0; i < KEYS; i++)
+        checksum = checksum * 31 + colors[i];
+    return time / frames;
+}
+
+int main(int argc, char** argv){
+    int frames = 20000;
+    if(argc == 3 && !strcmp(argv[1], "-n"))
+        frames = atoi(argv[2]);
+    if(frames < 1 || (argc != 1 && argc != 3)){
+        printf("Usage: %s [-n <frames>]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    std::vector<QRgb> base(KEYS), indicators(KEYS);
+    std::vector<std::vector<QRgb>> layers(LAYERS, std::vector<QRgb>(KEYS));
+    for(int i = 0; i < KEYS; i++){
+        base[i] = randomColor() | 0xff000000;
+        // Most keys aren't indicators
+        indicators[i] = (i % 10) ? 0 : randomColor();
+        for(int layer = 0; layer < LAYERS; layer++)
+            layers[layer][i] = randomColor();
+    }
+
+    static const char* const modes[] = { "Normal", "Add", "Subtract", "Multiply", "Divide" };
+    int res = 0;
+    printf("%d keys, %d layers, %d frames\n", KEYS, LAYERS, frames);
+    for(int mode = 0; mode < 5; mode++){
+        unsigned scalarSum = 0, vectorSum = 0;
+        double scalar = blendFrames(frames, mode, true, base, layers, scalarSum);
+        double vector = blendFrames(frames, mode, false, base, layers, vectorSum);
+        printf("blendColors %-8s %9.1f ns/frame scalar, %9.1f ns/frame vector (%.2fx)%s\n", modes[mode], scalar, vector,
+               scalar / vector, scalarSum == vectorSum ? "" : ", RESULTS DIFFER");
+        if(scalarSum != vectorSum)
+            res = 1;
+    }
+    unsigned scalarSum = 0, vectorSum = 0;
+    double scalar = postFrames(frames, true, base, indicators, scalarSum);
+    double vector = postFrames(frames, false, base, indicators, vectorSum);
+    printf("overlay+dim          %9.1f ns/frame scalar, %9.1f ns/frame vector (%.2fx)%s\n", scalar, vector,
+           scalar / vector, scalarSum == vectorSum ? "" : ", RESULTS DIFFER");
+    if(scalarSum != vectorSum)
+        res = 1;
+    return res;
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "kbblend.h"
+
+// Checks that the vectorized kernels in kbblend.cpp give exactly the same colors as the scalar code.
+// Arrays of less than four keys never reach the vector code, so running the kernels one key at a time gives the
+// scalar output to compare against.
+
+// Not a multiple of four, so the scalar code also runs for the last keys of the whole array
+static const int KEYS = 151;
+static const int ROUNDS = 500;
+
+static int failures = 0;
+
+// Mostly random, but with plenty of the values that need special handling (black, white, transparent, opaque)
+static int randomChannel(){
+    switch(rand() % 4){
+    case 0:
+        return 0;
+    case 1:
+        return 255;
+    default:
+        return rand() % 256;
+    }
+}
+
+static QRgb randomColor(){
+    return qRgba(randomChannel(), randomChannel(), randomChannel(), randomChannel());
+}
+
+static void compare(const char* what, int mode, const std::vector<QRgb>& bg, const std::vector<QRgb>& fg,
+                    const std::vector<QRgb>& expected, const std::vector<QRgb>& actual){
+    for(int i = 0; i < KEYS; i++){
+        if(expected[i] == actual[i])
+            continue;
+        if(failures++ < 20)
+            printf("%s mode %d, key %d: %08x over %08x gave %08x, expected %08x\n", what, mode, i, fg[i], bg[i], actual[i], expected[i]);
+    }
+}
+
+int main(){
+    srand(1);
+    const double opacities[] = { 1.0, 0.6, 0.0 };
+    for(int round = 0; round < ROUNDS; round++){
+        std::vector<QRgb> bg(KEYS), fg(KEYS);
+        for(int i = 0; i < KEYS; i++){
+            bg[i] = randomColor();
+            fg[i] = randomColor();
+        }
+
+        for(int mode = 0; mode < 5; mode++){
+            for(double opacity : opacities){
+                std::vector<QRgb> expected = bg, actual = bg;
+                for(int i = 0; i < KEYS; i++)
+                    blendColors(&expected[i], &fg[i], 1, mode, opacity);
+                blendColors(actual.data(), fg.data(), KEYS, mode, opacity);
+                compare("blendColors", mode, bg, fg, expected, actual);
+            }
+        }
+
+        std::vector<QRgb> expected = bg, actual = bg;
+        for(int i = 0; i < KEYS; i++)
+            overlayColors(&expected[i], &fg[i], 1);
+        overlayColors(actual.data(), fg.data(), KEYS);
+        compare("overlayColors", 0, bg, fg, expected, actual);
+    }
+
+    if(failures){
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("Vector and scalar blending match\n");
+    return 0;
+}
@@ -32,6 +32,11 @@
 //     Requests frame data from the animation. Update the context with appropriate colors.
 //     Return 0 to continue running or any other number to exit. On exit, the last-set frame will remain on the keyboard.
 
+// By default the animation is built as a program that ckb-next runs and talks to through stdin/stdout.
+// If CKB_PLUGIN is defined, no main function is generated. Instead, the ckb_plugin_* functions below are exported so that
+// ckb-next can load the animation as a shared library (<program name>.so, installed next to the program) and call it directly.
+// The program is still needed for ckb_info. All of the above applies in both cases.
+
 #include <ctype.h>
 #include <math.h>
 #include <stdio.h>
@@ -169,6 +174,26 @@ void ckb_grad_color(float* a, float* r, float* g, float* b, const ckb_gradient*
 // Alpha blend a color into a key
 void ckb_alpha_blend(ckb_key* key, float a, float r, float g, float b);
 
+// * Shared library interface (CKB_PLUGIN)
+
+#define CKB_PLUGIN_ABI 1
+#define CKB_PLUGIN_EXPORT __attribute__((visibility("default")))
+
+// Returns CKB_PLUGIN_ABI.
+CKB_PLUGIN_EXPORT int ckb_plugin_abi(void);
+// Creates a run context for the given keys and calls ckb_init. Key positions are relative to the top-left key.
+CKB_PLUGIN_EXPORT ckb_runctx* ckb_plugin_open(unsigned keycount, const char* const* names, const int* x, const int* y);
+// Wrappers for ckb_parameter, ckb_start, ckb_time. Parameter values are not URL-encoded.
+CKB_PLUGIN_EXPORT void ckb_plugin_parameter(ckb_runctx* context, const char* name, const char* value);
+CKB_PLUGIN_EXPORT void ckb_plugin_start(ckb_runctx* context, int state);
+CKB_PLUGIN_EXPORT void ckb_plugin_time(ckb_runctx* context, double delta);
+// Key event, by name if name is not null, otherwise by position.
+CKB_PLUGIN_EXPORT void ckb_plugin_keypress(ckb_runctx* context, const char* name, int x, int y, int state);
+// Calls ckb_frame and writes A, R, G, B for each key in keymap order to argb (keycount * 4 bytes). Returns the result of ckb_frame.
+CKB_PLUGIN_EXPORT int ckb_plugin_frame(ckb_runctx* context, unsigned char* argb);
+// Frees a context returned by ckb_plugin_open.
+CKB_PLUGIN_EXPORT void ckb_plugin_close(ckb_runctx* context);
+
 
 // * Internal functions
 
@@ -353,6 +378,103 @@ extern void ckb_start(ckb_runctx*, int);
 extern void ckb_time(ckb_runctx*, double);
 extern int ckb_frame(ckb_runctx*);
 
+// Key lookup
+ckb_key* ckb_keyforname(ckb_runctx* ctx, const char* name){
+    unsigned i = 0;
+    for(; i < ctx->keycount; i++){
+        if(!strcmp(ctx->keys[i].name, name))
+            return ctx->keys + i;
+    }
+    return 0;
+}
+
+ckb_key* ckb_keyforpos(ckb_runctx* ctx, int x, int y){
+    unsigned i = 0;
+    for(; i < ctx->keycount; i++){
+        if(ctx->keys[i].x == x && ctx->keys[i].y == y)
+            return ctx->keys + i;
+    }
+    return 0;
+}
+
+// Frame output in binary format
+void ckb_write_argb(ckb_runctx* ctx, unsigned char* argb){
+    unsigned i = 0;
+    for(; i < ctx->keycount; i++, argb += 4){
+        ckb_key* key = ctx->keys + i;
+        argb[0] = key->a;
+        argb[1] = key->r;
+        argb[2] = key->g;
+        argb[3] = key->b;
+    }
+}
+
+#ifdef CKB_PLUGIN
+
+int ckb_plugin_abi(void){
+    return CKB_PLUGIN_ABI;
+}
+
+ckb_runctx* ckb_plugin_open(unsigned keycount, const char* const* names, const int* x, const int* y){
+    if(keycount == 0)
+        return 0;
+    ckb_runctx* ctx = (ckb_runctx*)calloc(1, sizeof(ckb_runctx));
+    ctx->keys = (ckb_key*)calloc(keycount, sizeof(ckb_key));
+    ctx->keycount = keycount;
+    int max_x = 0, max_y = 0;
+    unsigned i = 0;
+    for(; i < keycount; i++){
+        ckb_key* key = ctx->keys + i;
+        strncpy(key->name, names[i], CKB_KEYNAME_MAX);
+        key->name[CKB_KEYNAME_MAX] = '\0';
+        key->x = x[i];
+        key->y = y[i];
+        if(x[i] > max_x)
+            max_x = x[i];
+        if(y[i] > max_y)
+            max_y = y[i];
+    }
+    ctx->width = max_x + 1;
+    ctx->height = max_y + 1;
+    ckb_init(ctx);
+    return ctx;
+}
+
+void ckb_plugin_parameter(ckb_runctx* ctx, const char* name, const char* value){
+    ckb_parameter(ctx, name, value);
+}
+
+void ckb_plugin_start(ckb_runctx* ctx, int state){
+    ckb_start(ctx, state);
+}
+
+void ckb_plugin_time(ckb_runctx* ctx, double delta){
+    ckb_time(ctx, delta);
+}
+
+void ckb_plugin_keypress(ckb_runctx* ctx, const char* name, int x, int y, int state){
+    ckb_key* key = name ? ckb_keyforname(ctx, name) : ckb_keyforpos(ctx, x, y);
+    if(key)
+        ckb_keypress(ctx, key, key->x, key->y, state);
+    else if(!name)
+        ckb_keypress(ctx, 0, x, y, state);
+}
+
+int ckb_plugin_frame(ckb_runctx* ctx, unsigned char* argb){
+    int end = ckb_frame(ctx);
+    ckb_write_argb(ctx, argb);
+    return end;
+}
+
+void ckb_plugin_close(ckb_runctx* ctx){
+    if(!ctx)
+        return;
+    free(ctx->keys);
+    free(ctx);
+}
+
+#else
+
 // Update parameter values
 void ckb_read_params(ckb_runctx* ctx){
     char cmd[CKB_MAX_WORD], param[CKB_MAX_WORD], value[CKB_MAX_WORD];
@@ -419,13 +541,16 @@ int main(int argc, char *argv[]){
             }
             ctx.width = max_x + 1;
             ctx.height = max_y + 1;
-            // Skip anything else until "end keymap"
+            // Skip anything else until "end keymap". Use binary frames if ckb-next supports them
+            unsigned char* binframe = 0;
             do {
                 ckb_getline(cmd, param, value);
                 if(!*cmd){
                     printf("Error [ckb-main]: Reached EOF looking for \"end keymap\"");
                     return -2;
                 }
+                if(!strcmp(cmd, "frameformat") && !strcmp(param, "binary") && !binframe)
+                    binframe = (unsigned char*)malloc(keycount * 4);
             } while(strcmp(cmd, "end") || strcmp(param, "keymap"));
             // Run init function
             ckb_init(&ctx);
@@ -465,38 +590,33 @@ int main(int argc, char *argv[]){
                     int x, y;
                     if(sscanf(param, "%d,%d", &x, &y) == 2){
                         // Find a key with this position
-                        ckb_key* key = 0;
-                        for(i = 0; i < keycount; i++){
-                            if(ctx.keys[i].x == x && ctx.keys[i].y == y){
-                                key = ctx.keys + i;
-                                break;
-                            }
-                        }
+                        ckb_key* key = ckb_keyforpos(&ctx, x, y);
                         if(key)
                             ckb_keypress(&ctx, key, key->x, key->y, !strcmp(value, "down"));
                         else
                             ckb_keypress(&ctx, 0, x, y, !strcmp(value, "down"));
                     } else {
                         // Find a key with this name
-                        ckb_key* key = 0;
-                        for(i = 0; i < keycount; i++){
-                            if(!strcmp(ctx.keys[i].name, param)){
-                                key = ctx.keys + i;
-                                break;
-                            }
-                        }
+                        ckb_key* key = ckb_keyforname(&ctx, param);
                         if(key)
                             ckb_keypress(&ctx, key, key->x, key->y, !strcmp(value, "down"));
                     }
                 } else if(!strcmp(cmd, "frame")){
                     int end = ckb_frame(&ctx);
                     // Output the frame
-                    printf("begin frame\n");
-                    for(i = 0; i < ctx.keycount; i++){
-                        ckb_key* key = ctx.keys + i;
-                        printf("argb %s %02hhx%02hhx%02hhx%02hhx\n", key->name, key->a, key->r, key->g, key->b);
+                    if(binframe){
+                        // Binary: A, R, G, B for each key, in keymap order
+                        ckb_write_argb(&ctx, binframe);
+                        printf("begin binframe\n");
+                        fwrite(binframe, 4, ctx.keycount, stdout);
+                    } else {
+                        printf("begin frame\n");
+                        for(i = 0; i < ctx.keycount; i++){
+                            ckb_key* key = ctx.keys + i;
+                            printf("argb %s %02hhx%02hhx%02hhx%02hhx\n", key->name, key->a, key->r, key->g, key->b);
+                        }
+                        printf("end frame\n");
                     }
-                    printf("end frame\n");
                     if(end)
                         break;
                     fflush(stdout);
@@ -508,6 +628,7 @@ int main(int argc, char *argv[]){
             }
             printf("end run\n");
             fflush(stdout);
+            free(binframe);
             free(ctx.keys);
             return 0;
         }
@@ -516,6 +637,8 @@ int main(int argc, char *argv[]){
     return -1;
 }
 
+#endif  // CKB_PLUGIN
+
 #endif  // CKB_NO_MAIN
 
 #endif  // CKB_ANIM_H